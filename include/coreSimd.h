@@ -0,0 +1,777 @@
+#include <math.h>
+#include <string.h>
+#include "coreMath.h"
+
+/**
+ * @file
+ *
+ * Packed versions of the core mathematical types, holding several
+ * values side by side in lanes so that one operation works on all of
+ * them at once.
+ *
+ * Float4 and Float8 hold four and eight floats. Vector2x4 and
+ * Vector2x8 hold four and eight Vector2s as a lane of x values and a
+ * lane of y values, and offer the same operations as Vector2, each
+ * returning lanes where Vector2 returns a float. A kernel written
+ * against these types compiles to SSE or AVX instructions when the
+ * compiler is targeting them, and to plain loops over arrays
+ * otherwise:
+ *
+ * - Float4 uses SSE if the compiler targets SSE2 (always so for
+ *   64-bit x86).
+ *
+ * - Float8 uses AVX if the compiler targets AVX (e.g. -mavx2 or
+ *   /arch:AVX2), and otherwise a pair of Float4s.
+ *
+ * Define CORE_SIMD_SCALAR to build the plain versions everywhere,
+ * e.g. to check a kernel's results against them.
+ *
+ * Comparisons return masks: lanes with every bit set where the
+ * comparison holds and clear where it does not, for use with select
+ * and getMask.
+ */
+#ifndef CORE_SIMD
+#define CORE_SIMD
+
+#if !defined(CORE_SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CORE_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(CORE_SIMD_SSE) && defined(__AVX__)
+#define CORE_SIMD_AVX
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Four floats, operated on together.
+ */
+class Float4
+    {
+    public:
+        /** The number of lanes. */
+        enum { WIDTH = 4 };
+
+#ifdef CORE_SIMD_SSE
+        /** Holds the lanes. */
+        __m128 v;
+
+        Float4(__m128 v) : v(v) {}
+#else
+        /** Holds the lanes. */
+        float v[4];
+#endif
+
+    public:
+        /** The default constructor sets every lane to zero. */
+        Float4()
+        {
+#ifdef CORE_SIMD_SSE
+            v = _mm_setzero_ps();
+#else
+            v[0] = v[1] = v[2] = v[3] = 0;
+#endif
+        }
+
+        /** Sets every lane to the given value. */
+        explicit Float4(float value)
+        {
+#ifdef CORE_SIMD_SSE
+            v = _mm_set1_ps(value);
+#else
+            v[0] = v[1] = v[2] = v[3] = value;
+#endif
+        }
+
+        /** Reads four consecutive floats, which need not be aligned. */
+        static Float4 load(const float *values)
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_loadu_ps(values));
+#else
+            Float4 result;
+            for (unsigned i = 0; i < 4; i++) result.v[i] = values[i];
+            return result;
+#endif
+        }
+
+        /** Writes the lanes to four consecutive floats. */
+        void store(float *values) const
+        {
+#ifdef CORE_SIMD_SSE
+            _mm_storeu_ps(values, v);
+#else
+            for (unsigned i = 0; i < 4; i++) values[i] = v[i];
+#endif
+        }
+
+        /** Returns the value of the given lane. */
+        float operator[](unsigned lane) const
+        {
+            float values[4];
+            store(values);
+            return values[lane];
+        }
+
+        Float4 operator+(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_add_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = v[i] + o.v[i];
+            return r;
+#endif
+        }
+
+        Float4 operator-(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_sub_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = v[i] - o.v[i];
+            return r;
+#endif
+        }
+
+        Float4 operator*(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_mul_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = v[i] * o.v[i];
+            return r;
+#endif
+        }
+
+        Float4 operator/(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_div_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = v[i] / o.v[i];
+            return r;
+#endif
+        }
+
+        Float4 operator-() const
+        {
+            return Float4() - *this;
+        }
+
+        void operator+=(const Float4 &o) { *this = *this + o; }
+        void operator-=(const Float4 &o) { *this = *this - o; }
+        void operator*=(const Float4 &o) { *this = *this * o; }
+
+        /** Returns a mask of the lanes less than the other's. */
+        Float4 operator<(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_cmplt_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = maskLane(v[i] < o.v[i]);
+            return r;
+#endif
+        }
+
+        /** Returns a mask of the lanes less than or equal to the other's. */
+        Float4 operator<=(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_cmple_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = maskLane(v[i] <= o.v[i]);
+            return r;
+#endif
+        }
+
+        /** Returns a mask of the lanes greater than the other's. */
+        Float4 operator>(const Float4 &o) const
+        {
+            return o < *this;
+        }
+
+        /** Returns a mask of the lanes greater than or equal to the other's. */
+        Float4 operator>=(const Float4 &o) const
+        {
+            return o <= *this;
+        }
+
+        /** Returns a mask of the lanes set in both masks. */
+        Float4 operator&(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_and_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = maskLane(bits(v[i]) & bits(o.v[i]));
+            return r;
+#endif
+        }
+
+        /** Returns a mask of the lanes set in either mask. */
+        Float4 operator|(const Float4 &o) const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_or_ps(v, o.v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = maskLane(bits(v[i]) | bits(o.v[i]));
+            return r;
+#endif
+        }
+
+        /**
+         * Returns the lanes of a where the mask is set and of b where
+         * it is clear.
+         */
+        static Float4 select(const Float4 &mask, const Float4 &a, const Float4 &b)
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = bits(mask.v[i]) ? a.v[i] : b.v[i];
+            return r;
+#endif
+        }
+
+        /**
+         * Returns a bit for each lane of a mask, lane 0 in the lowest
+         * bit, set if the lane is set.
+         */
+        int getMask() const
+        {
+#ifdef CORE_SIMD_SSE
+            return _mm_movemask_ps(v);
+#else
+            int result = 0;
+            for (unsigned i = 0; i < 4; i++) if (bits(v[i])) result |= 1 << i;
+            return result;
+#endif
+        }
+
+        /** Returns the smaller of each pair of lanes. */
+        static Float4 min(const Float4 &a, const Float4 &b)
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_min_ps(a.v, b.v));
+#else
+            return select(a < b, a, b);
+#endif
+        }
+
+        /** Returns the larger of each pair of lanes. */
+        static Float4 max(const Float4 &a, const Float4 &b)
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_max_ps(a.v, b.v));
+#else
+            return select(a > b, a, b);
+#endif
+        }
+
+        /** Returns the square root of each lane. */
+        Float4 sqrt() const
+        {
+#ifdef CORE_SIMD_SSE
+            return Float4(_mm_sqrt_ps(v));
+#else
+            Float4 r;
+            for (unsigned i = 0; i < 4; i++) r.v[i] = ::sqrtf(v[i]);
+            return r;
+#endif
+        }
+
+        /** Returns one over the square root of each lane. */
+        Float4 inverseSqrt() const
+        {
+            return Float4(1.0f) / sqrt();
+        }
+
+        /**
+         * Returns an approximation of one over the square root of
+         * each lane, within a few parts in ten million, from the
+         * processor's estimate refined by a step of Newton's method.
+         * Without SSE it is exact.
+         */
+        Float4 fastInverseSqrt() const
+        {
+#ifdef CORE_SIMD_SSE
+            __m128 estimate = _mm_rsqrt_ps(v);
+            __m128 halfV = _mm_mul_ps(v, _mm_set1_ps(0.5f));
+            __m128 square = _mm_mul_ps(estimate, estimate);
+            return Float4(_mm_mul_ps(estimate,
+                _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfV, square))));
+#else
+            return inverseSqrt();
+#endif
+        }
+
+#ifndef CORE_SIMD_SSE
+    private:
+        static unsigned bits(float value)
+        {
+            unsigned result;
+            memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+
+        static float maskLane(unsigned set)
+        {
+            unsigned pattern = set ? 0xffffffffu : 0;
+            float result;
+            memcpy(&result, &pattern, sizeof(result));
+            return result;
+        }
+#endif
+    };
+
+/**
+ * Eight floats, operated on together.
+ */
+class Float8
+    {
+    public:
+        /** The number of lanes. */
+        enum { WIDTH = 8 };
+
+#ifdef CORE_SIMD_AVX
+        /** Holds the lanes. */
+        __m256 v;
+
+        Float8(__m256 v) : v(v) {}
+#else
+        /** Holds the lanes, four at a time. */
+        Float4 lo, hi;
+
+        Float8(const Float4 &lo, const Float4 &hi) : lo(lo), hi(hi) {}
+#endif
+
+    public:
+        /** The default constructor sets every lane to zero. */
+#ifdef CORE_SIMD_AVX
+        Float8() : v(_mm256_setzero_ps()) {}
+#else
+        Float8() {}
+#endif
+
+        /** Sets every lane to the given value. */
+#ifdef CORE_SIMD_AVX
+        explicit Float8(float value) : v(_mm256_set1_ps(value)) {}
+#else
+        explicit Float8(float value) : lo(value), hi(value) {}
+#endif
+
+        /** Reads eight consecutive floats, which need not be aligned. */
+        static Float8 load(const float *values)
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_loadu_ps(values));
+#else
+            return Float8(Float4::load(values), Float4::load(values + 4));
+#endif
+        }
+
+        /** Writes the lanes to eight consecutive floats. */
+        void store(float *values) const
+        {
+#ifdef CORE_SIMD_AVX
+            _mm256_storeu_ps(values, v);
+#else
+            lo.store(values);
+            hi.store(values + 4);
+#endif
+        }
+
+        /** Returns the value of the given lane. */
+        float operator[](unsigned lane) const
+        {
+            float values[8];
+            store(values);
+            return values[lane];
+        }
+
+#ifdef CORE_SIMD_AVX
+#define CORE_SIMD_FLOAT8_BINARY(op, avx) \
+        Float8 operator op(const Float8 &o) const \
+        { \
+            return Float8(avx(v, o.v)); \
+        }
+#else
+#define CORE_SIMD_FLOAT8_BINARY(op, avx) \
+        Float8 operator op(const Float8 &o) const \
+        { \
+            return Float8(lo op o.lo, hi op o.hi); \
+        }
+#endif
+
+        CORE_SIMD_FLOAT8_BINARY(+, _mm256_add_ps)
+        CORE_SIMD_FLOAT8_BINARY(-, _mm256_sub_ps)
+        CORE_SIMD_FLOAT8_BINARY(*, _mm256_mul_ps)
+        CORE_SIMD_FLOAT8_BINARY(/, _mm256_div_ps)
+
+        /** Returns a mask of the lanes set in both masks. */
+        CORE_SIMD_FLOAT8_BINARY(&, _mm256_and_ps)
+
+        /** Returns a mask of the lanes set in either mask. */
+        CORE_SIMD_FLOAT8_BINARY(|, _mm256_or_ps)
+
+#undef CORE_SIMD_FLOAT8_BINARY
+
+        Float8 operator-() const
+        {
+            return Float8() - *this;
+        }
+
+        void operator+=(const Float8 &o) { *this = *this + o; }
+        void operator-=(const Float8 &o) { *this = *this - o; }
+        void operator*=(const Float8 &o) { *this = *this * o; }
+
+        /** Returns a mask of the lanes less than the other's. */
+        Float8 operator<(const Float8 &o) const
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_cmp_ps(v, o.v, _CMP_LT_OQ));
+#else
+            return Float8(lo < o.lo, hi < o.hi);
+#endif
+        }
+
+        /** Returns a mask of the lanes less than or equal to the other's. */
+        Float8 operator<=(const Float8 &o) const
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_cmp_ps(v, o.v, _CMP_LE_OQ));
+#else
+            return Float8(lo <= o.lo, hi <= o.hi);
+#endif
+        }
+
+        /** Returns a mask of the lanes greater than the other's. */
+        Float8 operator>(const Float8 &o) const
+        {
+            return o < *this;
+        }
+
+        /** Returns a mask of the lanes greater than or equal to the other's. */
+        Float8 operator>=(const Float8 &o) const
+        {
+            return o <= *this;
+        }
+
+        /**
+         * Returns the lanes of a where the mask is set and of b where
+         * it is clear.
+         */
+        static Float8 select(const Float8 &mask, const Float8 &a, const Float8 &b)
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_blendv_ps(b.v, a.v, mask.v));
+#else
+            return Float8(Float4::select(mask.lo, a.lo, b.lo),
+                          Float4::select(mask.hi, a.hi, b.hi));
+#endif
+        }
+
+        /**
+         * Returns a bit for each lane of a mask, lane 0 in the lowest
+         * bit, set if the lane is set.
+         */
+        int getMask() const
+        {
+#ifdef CORE_SIMD_AVX
+            return _mm256_movemask_ps(v);
+#else
+            return lo.getMask() | (hi.getMask() << 4);
+#endif
+        }
+
+        /** Returns the smaller of each pair of lanes. */
+        static Float8 min(const Float8 &a, const Float8 &b)
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_min_ps(a.v, b.v));
+#else
+            return Float8(Float4::min(a.lo, b.lo), Float4::min(a.hi, b.hi));
+#endif
+        }
+
+        /** Returns the larger of each pair of lanes. */
+        static Float8 max(const Float8 &a, const Float8 &b)
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_max_ps(a.v, b.v));
+#else
+            return Float8(Float4::max(a.lo, b.lo), Float4::max(a.hi, b.hi));
+#endif
+        }
+
+        /** Returns the square root of each lane. */
+        Float8 sqrt() const
+        {
+#ifdef CORE_SIMD_AVX
+            return Float8(_mm256_sqrt_ps(v));
+#else
+            return Float8(lo.sqrt(), hi.sqrt());
+#endif
+        }
+
+        /** Returns one over the square root of each lane. */
+        Float8 inverseSqrt() const
+        {
+            return Float8(1.0f) / sqrt();
+        }
+
+        /**
+         * Returns an approximation of one over the square root of
+         * each lane; see Float4::fastInverseSqrt.
+         */
+        Float8 fastInverseSqrt() const
+        {
+#ifdef CORE_SIMD_AVX
+            __m256 estimate = _mm256_rsqrt_ps(v);
+            __m256 halfV = _mm256_mul_ps(v, _mm256_set1_ps(0.5f));
+            __m256 square = _mm256_mul_ps(estimate, estimate);
+            return Float8(_mm256_mul_ps(estimate,
+                _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(halfV, square))));
+#else
+            return Float8(lo.fastInverseSqrt(), hi.fastInverseSqrt());
+#endif
+        }
+    };
+
+/**
+ * Several Vector2s, operated on together: a lane of x values and a
+ * lane of y values, of type Float4 or Float8.
+ */
+template <class Lanes>
+class Vector2Lanes
+    {
+    public:
+        /** The type of a lane of floats, such as a magnitude. */
+        typedef Lanes Floats;
+
+        /** The number of vectors held. */
+        enum { WIDTH = Lanes::WIDTH };
+
+        /** Holds the values along the x axis. */
+        Lanes x;
+
+        /** Holds the values along the y axis. */
+        Lanes y;
+
+    public:
+        /** The default constructor creates zero vectors. */
+        Vector2Lanes() {}
+
+        /** Creates vectors from the given lanes of components. */
+        Vector2Lanes(const Lanes &x, const Lanes &y)
+            : x(x), y(y) {}
+
+        /** Sets every vector to the given one. */
+        explicit Vector2Lanes(const Vector2 &vector)
+            : x(vector.x), y(vector.y) {}
+
+        /**
+         * Reads consecutive x and y values from separate arrays, as
+         * laid out in a ParticleStore.
+         */
+        static Vector2Lanes load(const float *xs, const float *ys)
+        {
+            return Vector2Lanes(Lanes::load(xs), Lanes::load(ys));
+        }
+
+        /** Writes the vectors to separate arrays of x and y values. */
+        void store(float *xs, float *ys) const
+        {
+            x.store(xs);
+            y.store(ys);
+        }
+
+        /** Returns the vector in the given lane. */
+        Vector2 operator[](unsigned lane) const
+        {
+            return Vector2(x[lane], y[lane]);
+        }
+
+        /** Adds the given vectors to these. */
+        void operator+=(const Vector2Lanes &v)
+        {
+            x += v.x;
+            y += v.y;
+        }
+
+        /** Returns the given vectors added to these. */
+        Vector2Lanes operator+(const Vector2Lanes &v) const
+        {
+            return Vector2Lanes(x + v.x, y + v.y);
+        }
+
+        /** Subtracts the given vectors from these. */
+        void operator-=(const Vector2Lanes &v)
+        {
+            x -= v.x;
+            y -= v.y;
+        }
+
+        /** Returns the given vectors subtracted from these. */
+        Vector2Lanes operator-(const Vector2Lanes &v) const
+        {
+            return Vector2Lanes(x - v.x, y - v.y);
+        }
+
+        /** Scales each vector by the value in its lane. */
+        void operator*=(const Lanes &value)
+        {
+            x *= value;
+            y *= value;
+        }
+
+        /** Returns each vector scaled by the value in its lane. */
+        Vector2Lanes operator*(const Lanes &value) const
+        {
+            return Vector2Lanes(x * value, y * value);
+        }
+
+        /** Returns the vectors all scaled by the given value. */
+        Vector2Lanes operator*(float value) const
+        {
+            return *this * Lanes(value);
+        }
+
+        /**
+         * Calculates and returns the component-wise products of these
+         * vectors with the given ones.
+         */
+        Vector2Lanes componentProduct(const Vector2Lanes &vector) const
+        {
+            return Vector2Lanes(x * vector.x, y * vector.y);
+        }
+
+        /**
+         * Calculates and returns the scalar products of these vectors
+         * with the given ones.
+         */
+        Lanes scalarProduct(const Vector2Lanes &vector) const
+        {
+            return x * vector.x + y * vector.y;
+        }
+
+        /**
+         * Calculates and returns the scalar products of these vectors
+         * with the given ones.
+         */
+        Lanes operator*(const Vector2Lanes &vector) const
+        {
+            return scalarProduct(vector);
+        }
+
+        /**
+         * Adds the given vectors to these, each scaled by the value
+         * in its lane.
+         */
+        void addScaledVector(const Vector2Lanes &vector, const Lanes &scale)
+        {
+            x += vector.x * scale;
+            y += vector.y * scale;
+        }
+
+        /** Gets the magnitudes of these vectors. */
+        Lanes magnitude() const
+        {
+            return squareMagnitude().sqrt();
+        }
+
+        /** Gets the squared magnitudes of these vectors. */
+        Lanes squareMagnitude() const
+        {
+            return x * x + y * y;
+        }
+
+        /**
+         * Turns the non-zero vectors into vectors of unit length,
+         * leaving zero vectors as they are.
+         */
+        void normalise()
+        {
+            Lanes square = squareMagnitude();
+            scaleByInverse(square, square.inverseSqrt());
+        }
+
+        /**
+         * As normalise, but with an approximate inverse square root
+         * that is faster where the processor provides one.
+         */
+        void fastNormalise()
+        {
+            Lanes square = squareMagnitude();
+            scaleByInverse(square, square.fastInverseSqrt());
+        }
+
+        /** Returns the normalised versions of these vectors. */
+        Vector2Lanes unit() const
+        {
+            Vector2Lanes result = *this;
+            result.normalise();
+            return result;
+        }
+
+        /** Returns the normalised versions, by fastNormalise. */
+        Vector2Lanes fastUnit() const
+        {
+            Vector2Lanes result = *this;
+            result.fastNormalise();
+            return result;
+        }
+
+        /**
+         * Returns the vectors of a where the mask is set and of b
+         * where it is clear.
+         */
+        static Vector2Lanes select(const Lanes &mask, const Vector2Lanes &a,
+                                   const Vector2Lanes &b)
+        {
+            return Vector2Lanes(Lanes::select(mask, a.x, b.x),
+                                Lanes::select(mask, a.y, b.y));
+        }
+
+        /** Zero all the components of the vectors. */
+        void clear()
+        {
+            x = y = Lanes();
+        }
+
+        /** Flips all the components of the vectors. */
+        void invert()
+        {
+            x = -x;
+            y = -y;
+        }
+
+    private:
+        /**
+         * Scales the vectors by the given inverse lengths, except
+         * those whose squared length is zero.
+         */
+        void scaleByInverse(const Lanes &square, const Lanes &inverse)
+        {
+            Lanes nonZero = square > Lanes();
+            Lanes scale = Lanes::select(nonZero, inverse, Lanes(1.0f));
+            x *= scale;
+            y *= scale;
+        }
+    };
+
+typedef Vector2Lanes<Float4> Vector2x4;
+typedef Vector2Lanes<Float8> Vector2x8;
+
+
+#endif // CORE_SIMD
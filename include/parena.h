@@ -0,0 +1,149 @@
+/*
+ * Interface file for the growable contact buffer.
+ *
+ */
+
+#ifndef PARENA_H
+#define PARENA_H
+
+#include <vector>
+#include "pcontacts.h"
+
+
+    /**
+     * A buffer of contacts that contact generators write into, which
+     * grows when a generator needs more room. Its capacity is kept
+     * between frames, so once the contact count settles no memory is
+     * allocated.
+     *
+     * A generator only writes as many contacts as it is given room
+     * for, so the arena gives it one spare slot past its room. One
+     * that writes into the spare had more, and the arena then doubles
+     * its capacity and runs the generator again.
+     * Generators are const, so running one again gives the same
+     * contacts.
+     *
+     * Growth can be capped. At the cap, contacts that do not fit are
+     * lost, as they were with the old fixed array, and the overflow
+     * is counted.
+     */
+    class ParticleContactArena
+    {
+    public:
+        /**
+         * What to do when a generator needs more room than the cap
+         * allows.
+         */
+        enum OverflowPolicy
+        {
+            /**
+             * Keep the contacts that fit and count the overflow.
+             */
+            OVERFLOW_DROP,
+
+            /**
+             * As OVERFLOW_DROP, but also fail an assertion, so debug
+             * builds stop at the first frame that loses contacts.
+             */
+            OVERFLOW_ASSERT
+        };
+
+    protected:
+        /**
+         * Holds the contacts, followed by one spare slot that
+         * generators may write into but whose contact is never kept.
+         * Its size is one more than the arena's capacity.
+         */
+        std::vector<ParticleContact> contacts;
+
+        /**
+         * Holds the most contacts the arena may grow to, or zero for
+         * no cap.
+         */
+        unsigned limit;
+
+        /**
+         * Holds what to do when the cap is reached.
+         */
+        OverflowPolicy policy;
+
+        /**
+         * Holds the number of times a generator was cut short by the
+         * cap.
+         */
+        unsigned overflows;
+
+    public:
+        /**
+         * Creates an arena with room for the given number of
+         * contacts and no cap.
+         */
+        ParticleContactArena(unsigned capacity = 0);
+
+        /**
+         * Returns the contacts.
+         */
+        ParticleContact* getContacts();
+
+        /**
+         * Returns the number of contacts there is room for without
+         * growing.
+         */
+        unsigned getCapacity() const;
+
+        /**
+         * Caps the capacity at the given number of contacts, or
+         * removes the cap if it is zero. If the arena is already
+         * bigger it shrinks to the cap.
+         */
+        void setLimit(unsigned limit, OverflowPolicy policy = OVERFLOW_DROP);
+
+        /**
+         * Returns the cap, or zero if there is none.
+         */
+        unsigned getLimit() const;
+
+        /**
+         * Returns the number of times a generator has been cut short
+         * by the cap.
+         */
+        unsigned getOverflowCount() const;
+
+        /**
+         * Makes room for at least the given number of contacts, as
+         * far as the cap allows. Returns the capacity.
+         */
+        unsigned reserve(unsigned count);
+
+        /**
+         * Runs the generator, writing from the given offset on and
+         * growing the arena until the generator stops short of the
+         * room it was given, or the cap is reached. Returns the
+         * number of contacts written.
+         *
+         * The generator is given the spare slot as well as its room,
+         * and one that writes into it had more contacts than fitted:
+         * the arena grows and runs it again, or at the cap counts an
+         * overflow. A generator that exactly fills its room is not
+         * run twice.
+         */
+        unsigned generate(const ParticleContactGenerator *generator,
+                          unsigned offset);
+
+        /**
+         * Copies the given contacts in from the given offset on, as
+         * many as the cap allows. Returns the number copied.
+         */
+        unsigned append(const ParticleContact *source, unsigned count,
+                        unsigned offset);
+
+        /**
+         * Counts an overflow and applies the policy. Used by the
+         * arena itself, and by owners of staging arenas whose
+         * overflows should count against this one.
+         */
+        void recordOverflow();
+    };
+
+
+#endif // PARENA_H
@@ -1,27 +1,33 @@
     /**
      * A particle is the simplest object that can be simulated in the
      * physics system.
-
+     *
+     * The particle's state lives in a ParticleStore owned by its
+     * world; a Particle is a lightweight handle onto one slot of that
+     * store. Handles are created by ParticleWorld::createParticle.
      */
 
 #ifndef PARTICLE_H
 #define PARTICLE_H
 
 #include "coreMath.h"
+#include "pstore.h"
 
     class Particle
     {
     protected:
 
-	float inverseMass;
-	float damping;
-	float radius;
-    Vector2 position;
-	Vector2 velocity;
-	Vector2 forceAccum;
-	Vector2 acceleration;
+	ParticleStore *store;
+	unsigned index;
     
 	public:
+		Particle(ParticleStore *store, unsigned index);
+
+		/**
+		 * Returns the index of this particle in its store.
+		 */
+		unsigned getIndex() const;
+
 		void integrate(float duration);
 		void setMass(const float mass);
 		float getMass() const;
@@ -29,6 +35,12 @@
 		float getInverseMass() const;
 		bool hasFiniteMass() const;
 
+		/**
+		 * Returns false while the particle is asleep. Particles are
+		 * put to sleep and woken by their world's ParticleSleep.
+		 */
+		bool isAwake() const;
+
 	    void setDamping(const float damping);
         float getDamping() const;
 
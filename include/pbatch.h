@@ -0,0 +1,175 @@
+/*
+ * Interface file for contact generators that work on a whole batch
+ * of a world's particles at once.
+ *
+ */
+
+#ifndef PBATCH_H
+#define PBATCH_H
+
+#include <vector>
+#include "pworld.h"
+
+
+    /**
+     * A view of the particle state a contact generator works from:
+     * the world's particle arrays, the handles to write into
+     * contacts, and the candidate pairs its broadphase found. Built
+     * once per generator call, or once for a whole set of generators,
+     * so no generator needs to hold particles of its own.
+     *
+     * The contact cache keys a generator's contacts by the generator
+     * registered with the world, owner, and by each contact's
+     * feature. A generator writes its own features offset by
+     * featureBase, so generators sharing an owner keep apart.
+     */
+    struct ParticleBatch
+    {
+        /** Holds the particles' state, one entry per particle. */
+        const ParticleStore &store;
+
+        /** Holds the handle of each particle of the store. */
+        Particle *const *particles;
+
+        /** Holds the candidate pairs from the world's broadphase. */
+        const ParticlePair *pairs;
+        unsigned pairCount;
+
+        /** Holds the cache contacts can be reused from. */
+        const ParticleContactCache &cache;
+
+        /** Holds the generator the cache keys contacts by. */
+        const void *owner;
+
+        /** Holds the offset added to each contact's feature. */
+        unsigned featureBase;
+
+        /**
+         * Creates a view of the given world's particles, for contacts
+         * cached under the given owner.
+         */
+        ParticleBatch(ParticleWorld &world, const void *owner);
+    };
+
+    /**
+     * The base of a contact generator that works on a batch. The
+     * derived class, Generator, provides
+     *
+     *     unsigned addContacts(const ParticleBatch &batch,
+     *                          ParticleContact *contact,
+     *                          unsigned limit) const;
+     *     unsigned getFeatureCount() const;
+     *
+     * where addContacts writes up to limit contacts from the batch
+     * and returns how many it wrote, and getFeatureCount returns how
+     * many features it numbers its contacts with (zero for contacts
+     * between particles).
+     *
+     * Registered with a world on its own, the generator is called
+     * through the ParticleContactGenerator interface, with a batch
+     * built from its world. Held by value in a ParticleGeneratorSet,
+     * it is called directly, with no virtual call per generator.
+     */
+    template <class Generator>
+    class ParticleBatchGenerator : public ParticleContactGenerator
+    {
+    public:
+        /**
+         * Holds the world whose particles the generator works on.
+         */
+        ParticleWorld *world;
+
+    public:
+        /**
+         * Creates a generator for the given world.
+         */
+        ParticleBatchGenerator(ParticleWorld *world = NULL)
+            : world(world) {}
+
+        /**
+         * Fills the given contact structure from a batch of the
+         * world's particles. A generator with no world generates
+         * nothing.
+         */
+        virtual unsigned addContact(ParticleContact *contact,
+                                    unsigned limit) const
+        {
+            if (!world) return 0;
+
+            ParticleBatch batch(*world, this);
+            return static_cast<const Generator*>(this)->addContacts(
+                batch, contact, limit);
+        }
+    };
+
+    /**
+     * A collection of contact generators of one type, registered with
+     * a world as a single generator. The world makes one virtual call
+     * for the whole set; the set builds one batch and calls each of
+     * its generators directly, so a level with many generators of a
+     * kind pays for neither a virtual call nor a copy of the
+     * particles per generator.
+     *
+     * The generators are held by value; see ParticleBatchGenerator
+     * for what their type must provide. Their own world member is
+     * not used.
+     */
+    template <class Generator>
+    class ParticleGeneratorSet : public ParticleContactGenerator
+    {
+    public:
+        typedef std::vector<Generator> Generators;
+
+        /**
+         * Holds the world whose particles the generators work on.
+         */
+        ParticleWorld *world;
+
+    protected:
+        /**
+         * Holds the generators.
+         */
+        Generators generators;
+
+    public:
+        /**
+         * Creates an empty set for the given world.
+         */
+        ParticleGeneratorSet(ParticleWorld *world)
+            : world(world) {}
+
+        /**
+         * Returns the generators, to add to or change. Changing them
+         * between frames leaves the contact cache keyed by the old
+         * features until it is next filled.
+         */
+        Generators& getGenerators()
+        {
+            return generators;
+        }
+
+        /**
+         * Fills the given contact structure with the contacts of
+         * each generator in turn, from one batch of the world's
+         * particles. A set with no world generates nothing.
+         */
+        virtual unsigned addContact(ParticleContact *contact,
+                                    unsigned limit) const
+        {
+            if (!world) return 0;
+
+            ParticleBatch batch(*world, this);
+
+            unsigned used = 0;
+            for (unsigned g = 0; g < generators.size() && used < limit; g++)
+            {
+                used += generators[g].addContacts(batch, contact + used,
+                                                  limit - used);
+                batch.featureBase += generators[g].getFeatureCount();
+            }
+            return used;
+        }
+    };
+
+
+#endif // PBATCH_H
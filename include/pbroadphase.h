@@ -0,0 +1,446 @@
+/*
+ * Interface file for the particle broadphase.
+ *
+ */
+
+#ifndef PBROADPHASE_H
+#define PBROADPHASE_H
+
+#include <functional>
+#include <vector>
+#include "coreMath.h"
+#include "pstore.h"
+#include "pjobs.h"
+
+
+    /**
+     * A pair of particles, given by their indices in the particle
+     * store, whose bounding circles overlap. The first index is
+     * always less than the second.
+     */
+    struct ParticlePair
+    {
+        unsigned first;
+        unsigned second;
+    };
+
+    typedef std::vector<ParticlePair> ParticlePairs;
+
+    /**
+     * This is the basic polymorphic interface for broadphases: data
+     * structures that cheaply find the pairs of particles which might
+     * be in contact, so that the exact tests only run on those.
+     */
+    class ParticleBroadphase
+    {
+    public:
+        /**
+         * A search for the pairs involving items [begin, end) of a
+         * broadphase's own ordering.
+         */
+        typedef std::function<void(unsigned begin, unsigned end,
+                                   ParticlePairs &pairs)> RangeSearch;
+
+    protected:
+        /**
+         * Holds the pool the pair search is spread over, or NULL to
+         * search on the calling thread.
+         */
+        ThreadPool *pool;
+
+        /**
+         * Holds the pairs found by each chunk of a parallel search.
+         */
+        std::vector<ParticlePairs> chunkPairs;
+
+    public:
+        ParticleBroadphase() : pool(NULL) {}
+
+        virtual ~ParticleBroadphase() {}
+
+        /**
+         * Sets the pool to spread the pair search over. Pass NULL to
+         * search on the calling thread.
+         */
+        void setThreadPool(ThreadPool *pool);
+
+        /**
+         * Brings the broadphase up to date with the particles in the
+         * store and replaces the contents of the given list with
+         * every pair of particles whose circles overlap.
+         */
+        virtual void findPairs(const ParticleStore &store,
+                               ParticlePairs &pairs) = 0;
+
+    protected:
+        /**
+         * Runs the search over [0, count) in chunks of the given
+         * size, on the pool if there is one, and appends the pairs
+         * to the list in the same order a single search would.
+         */
+        void searchRanges(unsigned count, unsigned grain,
+                          const RangeSearch &search, ParticlePairs &pairs);
+    };
+
+    /**
+     * A uniform grid broadphase. Each particle is placed in one grid
+     * cell, and only particles in the same or neighbouring cells are
+     * tested against each other, so pair finding is close to linear
+     * in the number of particles.
+     *
+     * Cells are twice the largest particle radius across, which makes
+     * the neighbouring cells enough to find every overlap. Only the
+     * occupied cells are stored, in an open-addressed hash table, so
+     * the world can be unbounded. All storage is kept between calls;
+     * once the particle count settles no memory is allocated.
+     *
+     * The grid also answers proximity queries at any distance, such
+     * as which particles lie near a point, once it has been built
+     * with cells of about that distance.
+     */
+    class ParticleHashGrid : public ParticleBroadphase
+    {
+    protected:
+        /**
+         * An occupied cell in the hash table. A slot is only in use
+         * if its stamp matches the current build, so the table never
+         * needs clearing.
+         */
+        struct Cell
+        {
+            int x;
+            int y;
+            unsigned stamp;
+            unsigned start;
+            unsigned count;
+        };
+
+        /**
+         * Holds the hash table of cells. Its size is a power of two
+         * at least twice the number of particles.
+         */
+        std::vector<Cell> table;
+
+        /**
+         * Holds the slots of the cells occupied in the current build.
+         */
+        std::vector<unsigned> occupied;
+
+        /**
+         * Holds the table slot of each particle's cell.
+         */
+        std::vector<unsigned> particleCell;
+
+        /**
+         * Holds the particle indices sorted by cell, so the particles
+         * in a cell are contiguous.
+         */
+        std::vector<unsigned> sorted;
+
+        /**
+         * Holds the stamp of the current build.
+         */
+        unsigned stamp;
+
+        /**
+         * Holds the cell size used in the last build.
+         */
+        float cellSize;
+
+        /**
+         * Holds the extra distance added to the largest radius when
+         * choosing the cell size.
+         */
+        float margin;
+
+    public:
+        /**
+         * Creates an empty grid.
+         */
+        ParticleHashGrid();
+
+        /**
+         * Sets the extra distance added to the largest particle
+         * radius when choosing the cell size.
+         */
+        void setMargin(float margin);
+
+        /**
+         * Returns the cell size used in the last build.
+         */
+        float getCellSize() const;
+
+        /**
+         * Returns the number of occupied cells in the last build.
+         */
+        unsigned getOccupiedCells() const;
+
+        /**
+         * Rebuilds the grid from the store and writes every pair of
+         * particles whose circles overlap.
+         */
+        virtual void findPairs(const ParticleStore &store,
+                               ParticlePairs &pairs);
+
+        /**
+         * Places every particle in its cell, using the given cell
+         * size.
+         */
+        void build(const ParticleStore &store, float cellSize);
+
+        /**
+         * Replaces the contents of the given list with every pair of
+         * particles whose centres are closer than the given distance,
+         * which must be no more than the cell size of the last build.
+         * The store must be the one the grid was built from.
+         */
+        void findPairsWithin(const ParticleStore &store, float distance,
+                             ParticlePairs &pairs);
+
+        /**
+         * Appends to the given list the index of every particle whose
+         * centre is closer than the given distance to the point. Any
+         * distance works, though one much larger than the cell size
+         * searches many cells. The store must be the one the grid was
+         * built from.
+         */
+        void findNeighbours(const ParticleStore &store, const Vector2 &point,
+                            float distance,
+                            std::vector<unsigned> &neighbours) const;
+
+    protected:
+        /**
+         * Tests the particles of cells [first, last) of the occupied
+         * list against each other and against those of the cells
+         * around them, appending each pair the test accepts. Every
+         * pair of neighbouring cells is visited once.
+         */
+        template <class Test>
+        void searchCells(unsigned first, unsigned last, const Test &test,
+                         ParticlePairs &pairs) const;
+
+        /**
+         * Returns the slot of the given cell, or the table size if
+         * the cell is empty in the current build.
+         */
+        unsigned find(int x, int y) const;
+
+        /**
+         * Returns the slot of the given cell, claiming an empty slot
+         * for it if needed.
+         */
+        unsigned insert(int x, int y);
+    };
+
+    /**
+     * A sort-and-sweep broadphase. The particles are kept sorted by
+     * the start of their extent along the axis they are most spread
+     * out on, and each particle is only tested against those whose
+     * extent starts before its own ends.
+     *
+     * The sorted order is kept between calls and repaired with an
+     * insertion sort, which is close to linear when particles move
+     * little between frames. The number of swaps the repair needed is
+     * available after each call as a measure of how coherent the
+     * motion was.
+     *
+     * Sweeping one axis suits sparse or strung-out scenes. In a dense
+     * 2-D scene many extents overlap on any axis, and the repair must
+     * swap every pair that passes along it. In the benchmark's
+     * drifting scatter it beats the hash grid only below about 5,000
+     * particles. At 50,000 it takes twice as long (about 15 against
+     * 7 ms), and at 500,000 nearly five times as long (657 against
+     * 137 ms, with some 4.9 million swaps a frame). Prefer the grid
+     * for dense scenes.
+     */
+    class ParticleSweepAndPrune : public ParticleBroadphase
+    {
+    protected:
+        /**
+         * A particle's extent along the sweep axis.
+         */
+        struct Entry
+        {
+            float min;
+            float max;
+            unsigned index;
+        };
+
+        /**
+         * Holds the particles, sorted by the start of their extent.
+         */
+        std::vector<Entry> entries;
+
+        /**
+         * Holds the sweep axis: 0 for x, 1 for y.
+         */
+        unsigned axis;
+
+        /**
+         * Holds the number of swaps made by the last insertion sort.
+         */
+        unsigned swaps;
+
+        /**
+         * True if the last call had to sort from scratch, because the
+         * particle count or the sweep axis changed.
+         */
+        bool resorted;
+
+    public:
+        /**
+         * Creates an empty broadphase.
+         */
+        ParticleSweepAndPrune();
+
+        /**
+         * Returns the current sweep axis: 0 for x, 1 for y.
+         */
+        unsigned getAxis() const;
+
+        /**
+         * Returns the number of swaps the last call needed to
+         * restore the sorted order.
+         */
+        unsigned getSwaps() const;
+
+        /**
+         * Returns true if the last call sorted from scratch instead
+         * of repairing the previous order.
+         */
+        bool wasResorted() const;
+
+        /**
+         * Re-sorts the particles and writes every pair of particles
+         * whose circles overlap.
+         */
+        virtual void findPairs(const ParticleStore &store,
+                               ParticlePairs &pairs);
+    };
+
+    /**
+     * A broadphase that keeps a list of neighbours for each particle
+     * across frames, as molecular dynamics codes do, for dense piles
+     * of slowly moving particles.
+     *
+     * The list holds every pair of particles whose centres were
+     * closer than twice the largest radius plus a skin distance when
+     * it was built. Until some particle moves more than half the skin
+     * from where it was then, no pair outside the list can overlap,
+     * so each frame only tests the pairs in the list, walking a
+     * compact array of neighbours per particle. Once one has moved
+     * that far, or particles are added or the largest radius grows,
+     * the list is rebuilt with a hash grid.
+     *
+     * A larger skin rebuilds less often but tests more pairs each
+     * frame. The test is over every particle, so one fast particle,
+     * such as a blob dropped onto a resting pile, forces a rebuild of
+     * the whole list, and a scene that always has one rebuilds every
+     * frame and gains nothing over the grid.
+     */
+    class ParticleVerletList : public ParticleBroadphase
+    {
+    protected:
+        /**
+         * Holds the grid the list is built with.
+         */
+        ParticleHashGrid grid;
+
+        /**
+         * Holds the pairs found by the grid in the last build.
+         */
+        ParticlePairs candidates;
+
+        /**
+         * Holds, for each particle, the start of its run of
+         * neighbours; the run ends where the next particle's starts.
+         */
+        std::vector<unsigned> neighbourStart;
+
+        /**
+         * Holds each particle's neighbours with higher indices, in
+         * runs by particle.
+         */
+        std::vector<unsigned> neighbours;
+
+        /**
+         * Holds the particle positions when the list was built.
+         */
+        std::vector<float> builtX;
+        std::vector<float> builtY;
+
+        /**
+         * Holds the largest particle radius when the list was built.
+         */
+        float builtRadius;
+
+        /**
+         * Holds the skin distance.
+         */
+        float skin;
+
+        /**
+         * Holds the number of times the list has been built.
+         */
+        unsigned rebuilds;
+
+        /**
+         * True if the last call rebuilt the list.
+         */
+        bool rebuilt;
+
+    public:
+        /**
+         * Creates an empty list with the given skin distance.
+         */
+        ParticleVerletList(float skin = 1.0f);
+
+        /**
+         * Sets the skin distance. The list is rebuilt on the next
+         * call.
+         */
+        void setSkin(float skin);
+
+        /**
+         * Returns the skin distance.
+         */
+        float getSkin() const;
+
+        /**
+         * Returns the number of times the list has been built.
+         */
+        unsigned getRebuildCount() const;
+
+        /**
+         * Returns true if the last call rebuilt the list.
+         */
+        bool wasRebuilt() const;
+
+        /**
+         * Returns the number of pairs in the list.
+         */
+        unsigned getNeighbourCount() const;
+
+        /**
+         * Rebuilds the list if any particle has moved too far since
+         * it was built, then writes every pair in it whose circles
+         * overlap.
+         */
+        virtual void findPairs(const ParticleStore &store,
+                               ParticlePairs &pairs);
+
+    protected:
+        /**
+         * Returns true if the list no longer covers every pair that
+         * might overlap.
+         */
+        bool needsRebuild(const ParticleStore &store, float maxRadius) const;
+
+        /**
+         * Builds the list from the store's current positions.
+         */
+        void build(const ParticleStore &store, float maxRadius);
+    };
+
+
+#endif // PBROADPHASE_H
@@ -0,0 +1,129 @@
+/*
+ * Interface file for the bounding volume hierarchy over static line
+ * segments.
+ *
+ */
+
+#ifndef PBVH_H
+#define PBVH_H
+
+#include <vector>
+#include "coreMath.h"
+
+
+    /**
+     * A static line segment of level geometry.
+     */
+    struct Segment
+    {
+        Vector2 start;
+        Vector2 end;
+    };
+
+    typedef std::vector<Segment> Segments;
+
+    /**
+     * A bounding volume hierarchy of axis-aligned boxes over a fixed
+     * set of segments. It is built once, by splitting the segments at
+     * the median along the longest axis, and then answers "which
+     * segments might touch this box" in logarithmic time.
+     */
+    class SegmentBVH
+    {
+    protected:
+        /**
+         * A node of the tree. Leaves hold a run of the order array;
+         * internal nodes have a count of zero, their left child
+         * immediately after them and their right child at index right.
+         */
+        struct Node
+        {
+            Vector2 min;
+            Vector2 max;
+            unsigned start;
+            unsigned count;
+            unsigned right;
+        };
+
+        /**
+         * Holds the nodes in depth-first order; the root is first.
+         */
+        std::vector<Node> nodes;
+
+        /**
+         * Holds the segment indices in leaf order.
+         */
+        std::vector<unsigned> order;
+
+        /**
+         * Holds the bounds of each segment.
+         */
+        std::vector<Vector2> segmentMin;
+        std::vector<Vector2> segmentMax;
+
+    public:
+        /**
+         * Holds the most segments a leaf may contain.
+         */
+        enum { MAX_LEAF_SIZE = 4 };
+
+        /**
+         * Builds the hierarchy over the given segments, replacing any
+         * previous contents.
+         */
+        void build(const Segments &segments);
+
+        /**
+         * Returns the number of nodes in the tree.
+         */
+        unsigned getNodeCount() const;
+
+        /**
+         * Calls visit(index) for every segment whose bounds overlap
+         * the box from min to max. A segment may be reported even if
+         * the segment itself does not cross the box.
+         */
+        template <typename Visitor>
+        void query(const Vector2 &min, const Vector2 &max, Visitor &visit) const
+        {
+            if (nodes.empty()) return;
+
+            // The tree is balanced, so its depth is logarithmic in
+            // the segment count and a small fixed stack is enough.
+            unsigned stack[64];
+            unsigned top = 0;
+            stack[top++] = 0;
+
+            while (top > 0)
+            {
+                const Node &node = nodes[stack[--top]];
+                if (node.min.x > max.x || node.max.x < min.x ||
+                    node.min.y > max.y || node.max.y < min.y) continue;
+
+                if (node.count == 0)
+                {
+                    stack[top++] = node.right;
+                    stack[top++] = (unsigned)(&node - &nodes[0]) + 1;
+                    continue;
+                }
+
+                for (unsigned i = node.start; i < node.start + node.count; i++)
+                {
+                    unsigned s = order[i];
+                    if (segmentMin[s].x > max.x || segmentMax[s].x < min.x ||
+                        segmentMin[s].y > max.y || segmentMax[s].y < min.y) continue;
+                    visit(s);
+                }
+            }
+        }
+
+    protected:
+        /**
+         * Builds the subtree over order[start, start + count) and
+         * returns the index of its root.
+         */
+        unsigned buildNode(unsigned start, unsigned count);
+    };
+
+
+#endif // PBVH_H
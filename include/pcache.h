@@ -0,0 +1,215 @@
+/*
+ * Interface file for the contact cache that carries contacts from
+ * one frame to the next.
+ *
+ */
+
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <vector>
+#include "pcontacts.h"
+
+
+    /**
+     * Remembers the contacts of the last frame, so that the next one
+     * can build on them instead of starting from nothing.
+     *
+     * A contact is recognised by the generator that made it, its
+     * first particle, and its second particle or, for contacts with
+     * the scenery, its feature. The cache keeps two things for each:
+     *
+     * The impulse the resolver applied. At the start of the next
+     * step that impulse is applied again before resolution, unless
+     * the contact is already coming apart, and then taken back as far
+     * as it leaves contacts separating. A resting stack then starts
+     * the step close to at rest, and the resolver has little left to
+     * do; with a small resolver tolerance it stops after a few
+     * iterations.
+     *
+     * The contact's normal and penetration, and where its particles
+     * were when they were worked out. If the particles have since
+     * moved relative to each other by less than the motion
+     * threshold, a generator can call reuse to update the penetration
+     * from the movement instead of testing the shapes again.
+     */
+    class ParticleContactCache
+    {
+    protected:
+        /**
+         * A remembered contact. A slot is only in use if its stamp
+         * matches its table's.
+         */
+        struct Entry
+        {
+            const void *owner;
+            unsigned first;
+            unsigned second;
+            unsigned stamp;
+
+            /** The geometry, and where the particles were for it. */
+            Vector2 normal;
+            float penetration;
+            Vector2 base[2];
+
+            /** The impulse applied this frame and the last. */
+            float impulse;
+            float previousImpulse;
+        };
+
+        /**
+         * An open-addressed hash table of entries, sized to a power
+         * of two at least twice the number of contacts.
+         */
+        struct Table
+        {
+            std::vector<Entry> entries;
+            unsigned stamp;
+        };
+
+        /**
+         * Holds this frame's contacts and last frame's. current is
+         * the index of this frame's.
+         */
+        Table tables[2];
+        unsigned current;
+
+        /**
+         * Holds the slot in this frame's table of each contact.
+         */
+        std::vector<unsigned> contactSlot;
+
+        /**
+         * True if the world should use the cache.
+         */
+        bool enabled;
+
+        /**
+         * Holds the fraction of last frame's impulse applied at the
+         * start of a step.
+         */
+        float warmStartFactor;
+
+        /**
+         * Holds the relative movement below which a contact's
+         * geometry is reused.
+         */
+        float motionThreshold;
+
+        /**
+         * Holds the number of contacts whose geometry was reused
+         * this frame.
+         */
+        unsigned reusedCount;
+
+    public:
+        /**
+         * Creates an empty, disabled cache.
+         */
+        ParticleContactCache();
+
+        /**
+         * Turns the cache on or off. A world only warm starts and
+         * reuses contacts while it is on.
+         */
+        void setEnabled(bool enabled);
+
+        /**
+         * Returns true if the cache is on.
+         */
+        bool isEnabled() const;
+
+        /**
+         * Sets the fraction, from 0 to 1, of last frame's impulse to
+         * apply at the start of a step.
+         */
+        void setWarmStartFactor(float warmStartFactor);
+
+        /**
+         * Returns the fraction of last frame's impulse applied.
+         */
+        float getWarmStartFactor() const;
+
+        /**
+         * Sets the relative movement below which generators may
+         * reuse a contact's geometry. Zero, the default, never
+         * reuses it.
+         */
+        void setMotionThreshold(float motionThreshold);
+
+        /**
+         * Returns the motion threshold.
+         */
+        float getMotionThreshold() const;
+
+        /**
+         * Returns the number of contacts whose geometry was reused
+         * in the last frame.
+         */
+        unsigned getReusedCount() const;
+
+        /**
+         * Returns the second key for a contact with the given part of
+         * the scenery, which keeps it apart from particle indices.
+         */
+        static unsigned sceneryKey(unsigned feature);
+
+        /**
+         * Looks up the contact last frame between the given first
+         * particle and second particle or scenery key, made by the
+         * given generator. If there was one and the particles, now
+         * at the given positions, have moved relative to each other
+         * by less than the motion threshold, writes its normal and
+         * its penetration corrected for the movement, and returns
+         * true. For scenery the second position is ignored.
+         */
+        bool reuse(const void *owner, unsigned first, unsigned second,
+                   const Vector2 &position0, const Vector2 &position1,
+                   Vector2 *normal, float *penetration) const;
+
+        /**
+         * Makes last frame's contacts the previous ones and clears
+         * room for the given number of this frame's.
+         */
+        void startFrame(unsigned count);
+
+        /**
+         * Records contacts [begin, end) of the array, made by the
+         * given generator, as this frame's. Call after startFrame,
+         * with the same array and indices warmStart will be given.
+         */
+        void store(const void *owner, const ParticleContact *contacts,
+                   unsigned begin, unsigned end);
+
+        /**
+         * Clears the accumulated impulse of each contact, then
+         * applies the impulse its match had last frame, scaled by
+         * the warm start factor, to those not already separating.
+         * Any of it that leaves a contact separating is taken back.
+         */
+        void warmStart(ParticleContact *contacts, unsigned count);
+
+        /**
+         * Records the impulse each contact ended the step with.
+         */
+        void storeImpulses(const ParticleContact *contacts, unsigned count);
+
+    protected:
+        /**
+         * Returns the slot holding the given key in the table, or
+         * the table size if there is none.
+         */
+        unsigned find(const Table &table, const void *owner,
+                      unsigned first, unsigned second) const;
+
+        /**
+         * Returns true if the entry can stand in for a new test of
+         * particles at the given positions, and writes its geometry.
+         */
+        bool reuseEntry(const Entry &entry, bool scenery,
+                        const Vector2 &position0, const Vector2 &position1,
+                        Vector2 *normal, float *penetration) const;
+    };
+
+
+#endif // PCACHE_H
@@ -0,0 +1,47 @@
+/*
+ * Interface file for the particle-particle contact generator.
+ *
+ */
+
+#ifndef PCOLLISIONS_H
+#define PCOLLISIONS_H
+
+#include "pbatch.h"
+
+
+    /**
+     * Generates a contact for every pair of overlapping particles in
+     * a world, treating each particle as a circle of its radius. The
+     * candidate pairs come from the world's broadphase, so the world
+     * must have one set for this generator to find anything.
+     */
+    class ParticleCollisions :
+        public ParticleBatchGenerator<ParticleCollisions>
+    {
+    public:
+        /**
+         * Holds the restitution of the generated contacts.
+         */
+        float restitution;
+
+    public:
+        /**
+         * Creates a generator for the given world.
+         */
+        ParticleCollisions(ParticleWorld *world, float restitution = 1.0f);
+
+        /**
+         * Fills the given contact structure with a contact for each
+         * overlapping candidate pair of the batch.
+         */
+        unsigned addContacts(const ParticleBatch &batch,
+                             ParticleContact *contact, unsigned limit) const;
+
+        /**
+         * Returns zero: the contacts are between particles.
+         */
+        unsigned getFeatureCount() const;
+    };
+
+
+#endif // PCOLLISIONS_H
@@ -0,0 +1,146 @@
+/*
+ * Interface file for the parallel, graph-coloured contact resolver.
+ *
+ */
+
+#ifndef PCOLORED_H
+#define PCOLORED_H
+
+#include <vector>
+#include "pcontacts.h"
+#include "pjobs.h"
+
+
+    /**
+     * A contact resolver that spreads the work over a thread pool.
+     *
+     * The contacts are first coloured so that no two contacts of the
+     * same colour share a particle. All the contacts of one colour can
+     * then be resolved at the same time without threads writing to the
+     * same particle. The colours are swept in turn, and the sweeps are
+     * repeated until no contact is closing faster than the tolerance,
+     * or the iteration limit is reached.
+     *
+     * Contacts are resolved in colour order rather than in order of
+     * closing velocity, so results are close to, but not the same as,
+     * those of ParticleContactResolver.
+     */
+    class ParticleColoredResolver
+    {
+    public:
+        /**
+         * Holds the most colours handed out. Contacts that would need
+         * more are resolved serially after the coloured batches.
+         */
+        enum { MAX_COLORS = 64 };
+
+    protected:
+        /**
+         * Holds the pool the batches are run on, or NULL to run them
+         * on the calling thread.
+         */
+        ThreadPool *pool;
+
+        /**
+         * Holds the maximum number of sweeps over all colours.
+         */
+        unsigned iterations;
+
+        /**
+         * Holds the number of sweeps used by the last call.
+         */
+        unsigned iterationsUsed;
+
+        /**
+         * Holds the closing velocity below which a contact is
+         * considered resolved.
+         */
+        float tolerance;
+
+        /**
+         * Holds the smallest number of contacts given to a thread.
+         */
+        unsigned grain;
+
+        /**
+         * Holds the contact indices sorted by colour. The contacts of
+         * colour c are order[colorStart[c]] up to order[colorStart[c+1]];
+         * the last, uncoloured, batch follows MAX_COLORS.
+         */
+        std::vector<unsigned> order;
+        std::vector<unsigned> colorStart;
+
+        /**
+         * Holds the contact colours, and for each particle the set of
+         * colours its contacts already use.
+         */
+        std::vector<unsigned> contactColor;
+        std::vector<unsigned long long> particleColors;
+
+        /**
+         * Holds the number of colours used by the last call.
+         */
+        unsigned colorsUsed;
+
+    public:
+        /**
+         * Creates a resolver that runs on the given pool, or on the
+         * calling thread if it is NULL.
+         */
+        ParticleColoredResolver(ThreadPool *pool, unsigned iterations,
+            float tolerance = 0.001f);
+
+        /**
+         * Sets the pool the batches are run on, or NULL to run them
+         * on the calling thread.
+         */
+        void setThreadPool(ThreadPool *pool);
+
+        /**
+         * Returns the pool the batches are run on.
+         */
+        ThreadPool* getThreadPool() const;
+
+        /**
+         * Sets the maximum number of sweeps over all colours.
+         */
+        void setIterations(unsigned iterations);
+
+        /**
+         * Sets the closing velocity below which a contact is
+         * considered resolved.
+         */
+        void setTolerance(float tolerance);
+
+        /**
+         * Sets the smallest number of contacts given to a thread.
+         */
+        void setGrain(unsigned grain);
+
+        /**
+         * Returns the number of sweeps used by the last call.
+         */
+        unsigned getIterationsUsed() const;
+
+        /**
+         * Returns the number of colours used by the last call.
+         */
+        unsigned getColorCount() const;
+
+        /**
+         * Resolves a set of particle contacts.
+         */
+        void resolveContacts(ParticleContact *contactArray,
+            unsigned numContacts,
+            float duration);
+
+    protected:
+        /**
+         * Colours the contacts and sorts them into batches.
+         */
+        void colorContacts(const ParticleContact *contactArray,
+            unsigned numContacts);
+    };
+
+
+#endif // PCOLORED_H
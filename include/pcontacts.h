@@ -6,10 +6,13 @@
 #ifndef PCONTACTS_H
 #define PCONTACTS_H
 
+#include <vector>
 #include "particle.h"
 
 
     class ParticleContactResolver;
+    class ParticleColoredResolver;
+    class ParticleContactCache;
 
     /**
      * A Contact represents two objects in contact (in this case
@@ -18,10 +21,12 @@
     class ParticleContact
     {
         /**
-         * The contact resolver object needs access into the contacts to
+         * The contact resolver objects need access into the contacts to
          * set and effect the contact.
          */
         friend ParticleContactResolver;
+        friend ParticleColoredResolver;
+        friend ParticleContactCache;
 
     public:
         /**
@@ -45,6 +50,21 @@
          */
         float penetration;
 
+        /**
+         * Identifies the part of the scenery touched, for contacts
+         * where the second particle is NULL; e.g. the index of the
+         * platform. Together with the particle and the generator it
+         * lets a contact be recognised from one frame to the next.
+         */
+        unsigned feature;
+
+        /**
+         * Holds the total impulse applied at this contact during the
+         * current step. Kept by the world's contact cache to warm
+         * start the next step.
+         */
+        float accumulatedImpulse;
+
 
     protected:
         /**
@@ -57,6 +77,12 @@
          */
         float calculateSeparatingVelocity() const;
 
+        /**
+         * Applies the given impulse along the contact normal, to
+         * both particles in proportion to their inverse masses.
+         */
+        void applyImpulse(float impulse);
+
     private:
         /**
          * Handles the impulse calculations for this collision.
@@ -71,6 +97,27 @@
      */
     class ParticleContactResolver
     {
+    public:
+        /**
+         * The ways the resolver can find the next contact to resolve.
+         * Both resolve the contacts in the same order.
+         */
+        enum Mode
+        {
+            /**
+             * Rescan every contact on every iteration. Cheapest for
+             * a handful of contacts.
+             */
+            MODE_SCAN,
+
+            /**
+             * Keep the contacts in an indexed min-heap on separating
+             * velocity, and after each resolution only re-key the
+             * contacts that share a particle with the resolved one.
+             */
+            MODE_HEAP
+        };
+
     protected:
         /**
          * Holds the number of iterations allowed.
@@ -83,17 +130,74 @@
          */
         unsigned iterationsUsed;
 
+        /**
+         * Holds the way the next contact is found.
+         */
+        Mode mode;
+
+        /**
+         * Holds the closing velocity below which a contact counts as
+         * resolved.
+         */
+        float tolerance;
+
+        /**
+         * Holds the heap of contact indices, and each contact's slot
+         * in it, for MODE_HEAP.
+         */
+        std::vector<unsigned> heap;
+        std::vector<unsigned> heapSlot;
+
+        /**
+         * Holds each contact's separating velocity, or HUGE_VALF
+         * (infinity) if the contact does not need resolving, for
+         * MODE_HEAP.
+         */
+        std::vector<float> keys;
+
+        /**
+         * Holds, for each particle index, the contacts it takes part
+         * in: those of particle p are adjacency[adjacencyStart[p]]
+         * up to adjacency[adjacencyStart[p+1]].
+         */
+        std::vector<unsigned> adjacencyStart;
+        std::vector<unsigned> adjacency;
+
     public:
         /**
          * Creates a new contact resolver.
          */
-        ParticleContactResolver(unsigned iterations);
+        ParticleContactResolver(unsigned iterations, Mode mode = MODE_SCAN);
 
         /**
          * Sets the number of iterations that can be used.
          */
         void setIterations(unsigned iterations);
 
+        /**
+         * Sets the way the next contact to resolve is found.
+         */
+        void setMode(Mode mode);
+
+        /**
+         * Returns the way the next contact to resolve is found.
+         */
+        Mode getMode() const;
+
+        /**
+         * Sets the closing velocity below which a contact counts as
+         * resolved. The default of zero resolves every closing
+         * contact, however slowly it closes; a small tolerance stops
+         * the resolver chasing rounding error in resting stacks.
+         */
+        void setTolerance(float tolerance);
+
+        /**
+         * Returns the number of iterations the last call to
+         * resolveContacts used.
+         */
+        unsigned getIterationsUsed() const;
+
         /**
          * Resolves a set of particle contacts for both penetration
          * and velocity.
@@ -102,6 +206,135 @@
         void resolveContacts(ParticleContact *contactArray,
             unsigned numContacts,
             float duration);
+
+    protected:
+        /**
+         * Resolves the contacts, rescanning them all each iteration.
+         */
+        void resolveByScan(ParticleContact *contactArray,
+            unsigned numContacts,
+            float duration);
+
+        /**
+         * Resolves the contacts, keeping them in a heap.
+         */
+        void resolveByHeap(ParticleContact *contactArray,
+            unsigned numContacts,
+            float duration);
+
+        /**
+         * Builds the particle to contacts adjacency for the given
+         * contacts.
+         */
+        void buildAdjacency(const ParticleContact *contactArray,
+            unsigned numContacts);
+
+        /**
+         * Returns true if contact a should be resolved before b.
+         */
+        bool heapBefore(unsigned a, unsigned b) const;
+
+        /**
+         * Restores the heap order around the given slot.
+         */
+        void siftUp(unsigned slot);
+        void siftDown(unsigned slot);
+    };
+
+    /**
+     * Pushes interpenetrating particles apart after the velocities
+     * have been resolved. Each contact moves its particles along its
+     * normal in proportion to their inverse masses, by a fixed
+     * fraction of the penetration beyond a small allowance, the slop.
+     * Leaving the slop keeps resting contacts touching, so they are
+     * still found next frame.
+     *
+     * All the contacts are corrected at once from the penetrations
+     * they were generated with. The contacts are gathered into flat
+     * arrays, the moves worked out in one branch-free loop the
+     * compiler can vectorise, and then added to the positions. A
+     * particle in several contacts gets the sum of their moves; the
+     * fraction, below one, keeps that from overshooting.
+     */
+    class ParticlePositionCorrector
+    {
+    protected:
+        /**
+         * True if the world should correct positions.
+         */
+        bool enabled;
+
+        /**
+         * Holds the fraction of the penetration corrected each step.
+         */
+        float factor;
+
+        /**
+         * Holds the penetration left uncorrected.
+         */
+        float slop;
+
+        /**
+         * Holds the contacts gathered into flat arrays: the store
+         * indices of their particles, their normals, penetrations,
+         * and the inverse masses of their particles. Contacts with
+         * the scenery use the first particle again as the second,
+         * with no inverse mass, so it is not moved.
+         */
+        std::vector<unsigned> first;
+        std::vector<unsigned> second;
+        std::vector<float> normalX;
+        std::vector<float> normalY;
+        std::vector<float> depth;
+        std::vector<float> weight0;
+        std::vector<float> weight1;
+
+    public:
+        /**
+         * Creates a disabled corrector with the given fraction and
+         * slop.
+         */
+        ParticlePositionCorrector(float factor = 0.8f, float slop = 0.01f);
+
+        /**
+         * Turns the correction on or off.
+         */
+        void setEnabled(bool enabled);
+
+        /**
+         * Returns true if the correction is on.
+         */
+        bool isEnabled() const;
+
+        /**
+         * Sets the fraction, from 0 to 1, of the penetration beyond
+         * the slop that is corrected each step.
+         */
+        void setFactor(float factor);
+
+        /**
+         * Returns the fraction of the penetration corrected.
+         */
+        float getFactor() const;
+
+        /**
+         * Sets the penetration left uncorrected.
+         */
+        void setSlop(float slop);
+
+        /**
+         * Returns the penetration left uncorrected.
+         */
+        float getSlop() const;
+
+        /**
+         * Moves the particles of the contacts, which must all be in
+         * the given store, to reduce their penetration, and lowers
+         * each contact's penetration by the separation applied.
+         */
+        void correctPositions(ParticleStore &store,
+                              ParticleContact *contactArray,
+                              unsigned numContacts);
     };
 
     /**
@@ -119,6 +352,28 @@
                                     unsigned limit) const = 0;
     };
 
+    /**
+     * Static scenery that fast particles are swept against, so they
+     * cannot pass through it in a single step. A world checks each of
+     * its obstacles for particles that move more than a fraction of
+     * their radius in a step; see ParticleWorld::setSweepThreshold.
+     */
+    class ParticleObstacle
+    {
+    public:
+        /**
+         * Sweeps a circle of the given radius from one position to
+         * another. If it hits the obstacle on the way, writes the
+         * fraction of the way it got, from 0 to 1, and the contact
+         * normal (pointing towards the circle) at that point, and
+         * returns true. A circle already touching at the start is
+         * left to the contact generators, and reports no hit.
+         */
+        virtual bool sweep(const Vector2 &from, const Vector2 &to,
+                           float radius, float *time,
+                           Vector2 *normal) const = 0;
+    };
+
 	
 
 #endif // CONTACTS_H
\ No newline at end of file
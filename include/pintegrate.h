@@ -0,0 +1,90 @@
+/*
+ * Interface file for the batch particle integrator.
+ *
+ */
+
+#ifndef PINTEGRATE_H
+#define PINTEGRATE_H
+
+#include "pstore.h"
+
+
+    /**
+     * Advances every particle in a ParticleStore by one step, several
+     * particles at a time. The integrator picks the widest instruction
+     * set the processor supports when it is created (AVX2, SSE2 or
+     * plain scalar code), and the choice can be overridden for testing
+     * and benchmarking.
+     *
+     * The damping factor pow(damping, duration) is computed once per
+     * distinct damping value per call, rather than once per particle.
+     */
+    class ParticleIntegrator
+    {
+    public:
+        /**
+         * The available integration kernels.
+         */
+        enum Kernel
+        {
+            KERNEL_SCALAR,
+            KERNEL_SSE2,
+            KERNEL_AVX2
+        };
+
+    protected:
+        /**
+         * Holds the kernel used by integrate.
+         */
+        Kernel kernel;
+
+    public:
+        /**
+         * Creates an integrator using the best kernel for this
+         * processor.
+         */
+        ParticleIntegrator();
+
+        /**
+         * Returns the widest kernel supported by this processor.
+         */
+        static Kernel bestKernel();
+
+        /**
+         * Returns true if the given kernel can run on this processor.
+         */
+        static bool isSupported(Kernel kernel);
+
+        /**
+         * Returns a printable name for the given kernel.
+         */
+        static const char* getKernelName(Kernel kernel);
+
+        /**
+         * Sets the kernel to use. Returns false, leaving the current
+         * kernel in place, if the processor does not support it.
+         */
+        bool setKernel(Kernel kernel);
+
+        /**
+         * Returns the kernel in use.
+         */
+        Kernel getKernel() const;
+
+        /**
+         * Integrates all the particles in the store forward in time
+         * by the given duration.
+         */
+        void integrate(ParticleStore &store, float duration) const;
+
+        /**
+         * Integrates the particles with indices in [begin, end)
+         * forward in time by the given duration. Disjoint ranges may
+         * be integrated concurrently.
+         */
+        void integrate(ParticleStore &store, unsigned begin, unsigned end,
+            float duration) const;
+    };
+
+
+#endif // PINTEGRATE_H
@@ -0,0 +1,161 @@
+/*
+ * Interface file for the work-stealing job system used by the
+ * physics system.
+ *
+ */
+
+#ifndef PJOBS_H
+#define PJOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+    /**
+     * Counts the outstanding tasks of a piece of work, so that the
+     * thread that started them can wait for them all to finish.
+     */
+    class TaskGroup
+    {
+    public:
+        /**
+         * Holds the number of tasks not yet finished.
+         */
+        std::atomic<unsigned> pending;
+
+        TaskGroup() : pending(0) {}
+    };
+
+    /**
+     * A work-stealing thread pool. Every thread has its own queue of
+     * tasks: it takes work from the back of its own queue and, when
+     * that is empty, steals from the front of the others'. The thread
+     * that waits on a task group runs tasks too, so a pool of one
+     * thread runs everything on the caller.
+     */
+    class ThreadPool
+    {
+    public:
+        /**
+         * A task with no arguments.
+         */
+        typedef std::function<void()> Task;
+
+        /**
+         * A piece of work over the indices [begin, end).
+         */
+        typedef std::function<void(unsigned begin, unsigned end)> RangeJob;
+
+    protected:
+        /**
+         * A queued task and the group it belongs to.
+         */
+        struct Entry
+        {
+            Task task;
+            TaskGroup *group;
+        };
+
+        /**
+         * A thread's task queue. Slot 0 belongs to whichever thread
+         * is not one of the workers, normally the simulation thread.
+         */
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Entry> entries;
+        };
+
+        /**
+         * Holds one queue per thread.
+         */
+        std::vector<Queue*> queues;
+
+        /**
+         * Holds the worker threads.
+         */
+        std::vector<std::thread> workers;
+
+        /**
+         * Holds the number of tasks queued across all threads.
+         */
+        std::atomic<unsigned> queued;
+
+        /**
+         * Lets idle workers sleep until there is work.
+         */
+        std::mutex mutex;
+        std::condition_variable wake;
+
+        /**
+         * True when the workers should exit.
+         */
+        bool stopping;
+
+    public:
+        /**
+         * Creates a pool with the given total number of threads,
+         * including the calling thread. Zero uses one thread per
+         * hardware thread.
+         */
+        ThreadPool(unsigned threads = 0);
+
+        /**
+         * Stops and joins the workers. Queued tasks are abandoned.
+         */
+        ~ThreadPool();
+
+        /**
+         * Returns the total number of threads, including the caller.
+         */
+        unsigned getThreadCount() const;
+
+        /**
+         * Queues a task as part of the given group. It may run on any
+         * thread.
+         */
+        void run(TaskGroup &group, const Task &task);
+
+        /**
+         * Runs queued tasks until every task of the group is done.
+         */
+        void wait(TaskGroup &group);
+
+        /**
+         * Splits [0, count) into chunks of at most grain indices and
+         * runs job on each, spread over the pool. Returns once every
+         * chunk is done.
+         */
+        void parallelFor(unsigned count, unsigned grain, const RangeJob &job);
+
+    protected:
+        /**
+         * Returns the queue slot of the calling thread.
+         */
+        unsigned currentSlot() const;
+
+        /**
+         * Takes a task from the given slot's own queue or, failing
+         * that, steals one from another queue. Returns false if every
+         * queue is empty.
+         */
+        bool takeTask(unsigned slot, Entry &entry);
+
+        /**
+         * Runs a task and marks it done in its group.
+         */
+        static void runEntry(Entry &entry);
+
+        /**
+         * The body of each worker thread.
+         */
+        void workerLoop(unsigned slot);
+    };
+
+
+#endif // PJOBS_H
@@ -0,0 +1,258 @@
+/*
+ * Interface file for contacts between particles and static platforms.
+ *
+ */
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include "pbatch.h"
+#include "pbvh.h"
+#include "coreSimd.h"
+
+
+    /**
+     * A platform segment compiled for contact tests: what every test
+     * against it needs, worked out once rather than per particle.
+     */
+    struct PlatformSegment
+    {
+        /** Holds the starting point of the segment. */
+        Vector2 start;
+
+        /** Holds the vector from the start to the end. */
+        Vector2 direction;
+
+        /**
+         * Holds one over the squared length, or zero if the segment
+         * is a point.
+         */
+        float inverseSquareLength;
+
+        /**
+         * Holds the unit normal on the left of the direction, used
+         * for a circle centred on the segment. A point has the
+         * normal (0, 1).
+         */
+        Vector2 normal;
+
+        /** Holds the bounds of the segment. */
+        Vector2 min;
+        Vector2 max;
+
+        /**
+         * Creates a point at the origin.
+         */
+        PlatformSegment();
+
+        /**
+         * Compiles the segment from start to end.
+         */
+        PlatformSegment(const Vector2 &start, const Vector2 &end);
+    };
+
+    typedef std::vector<PlatformSegment> PlatformSegments;
+
+    /**
+     * A single static platform, a line segment that every particle
+     * in a world collides with and bounces off. Fine for a handful of
+     * platforms, best held in a ParticleGeneratorSet so they share
+     * one batch; larger levels should use PlatformContacts.
+     *
+     * As an obstacle, it stops fast particles passing through it; see
+     * ParticleWorld::getObstacles.
+     */
+    class Platform : public ParticleBatchGenerator<Platform>,
+                     public ParticleObstacle
+    {
+    public:
+        /** Holds the starting point of the platform. */
+        Vector2 start;
+
+        /** Holds the ending point of the platform. */
+        Vector2 end;
+
+        /** Holds the bounciness of collisions with the platform. */
+        float restitution;
+
+    public:
+        /**
+         * Creates a platform at the origin that collides with no
+         * world.
+         */
+        Platform();
+
+        /**
+         * Creates a platform at the origin that collides with the
+         * particles of the given world.
+         */
+        Platform(ParticleWorld *world, float restitution = 1.0f);
+
+        /**
+         * Fills the given contact structure with a contact for each
+         * particle of the batch touching the platform.
+         */
+        unsigned addContacts(const ParticleBatch &batch,
+                             ParticleContact *contact, unsigned limit) const;
+
+        /**
+         * Returns one: the platform is the only feature.
+         */
+        unsigned getFeatureCount() const;
+
+        /**
+         * Sweeps a circle against the platform.
+         */
+        virtual bool sweep(const Vector2 &from, const Vector2 &to,
+                           float radius, float *time,
+                           Vector2 *normal) const;
+
+        /**
+         * Checks a circle against the segment from start to end. If
+         * they touch, fills in the contact normal (pointing towards
+         * the circle) and penetration depth and returns true.
+         */
+        static bool checkContact(const Vector2 &start, const Vector2 &end,
+            const Vector2 &position, float radius,
+            Vector2 *normal, float *penetration);
+
+        /**
+         * Checks a circle against a compiled segment, as above. The
+         * closest point is found by clamping the circle's projection
+         * onto the segment, so the ends need no branches of their
+         * own.
+         */
+        static bool checkContact(const PlatformSegment &segment,
+            const Vector2 &position, float radius,
+            Vector2 *normal, float *penetration);
+
+        /**
+         * Checks a lane of circles against a compiled segment at
+         * once, with no branches. Fills in every lane's normal and
+         * penetration, and returns a mask of the lanes that touch;
+         * the others' values are meaningless.
+         */
+        template <class Lanes>
+        static Lanes checkContacts(const PlatformSegment &segment,
+            const Vector2Lanes<Lanes> &position, const Lanes &radius,
+            Vector2Lanes<Lanes> *normal, Lanes *penetration)
+        {
+            typedef Vector2Lanes<Lanes> Vectors;
+
+            Vectors direction(segment.direction);
+            Vectors toParticle = position - Vectors(segment.start);
+            Lanes projected = (toParticle * direction) *
+                Lanes(segment.inverseSquareLength);
+            projected = Lanes::min(Lanes::max(projected, Lanes(0.0f)),
+                                   Lanes(1.0f));
+
+            Vectors offset = toParticle - direction * projected;
+            Lanes squareDistance = offset.squareMagnitude();
+            Lanes distance = squareDistance.sqrt();
+
+            // A circle centred on the segment takes its normal.
+            Lanes apart = distance > Lanes(0.0f);
+            Lanes scale = Lanes(1.0f) /
+                Lanes::select(apart, distance, Lanes(1.0f));
+            *normal = Vectors::select(apart, offset * scale,
+                                      Vectors(segment.normal));
+            *penetration = radius - distance;
+            return squareDistance < radius * radius;
+        }
+
+        /**
+         * Sweeps a circle from one position to another against the
+         * segment from start to end. If the circle, not touching the
+         * segment at first, hits it no later than the end of its
+         * path, lowers time to the fraction of the path covered when
+         * it does, writes the normal there, and returns true.
+         */
+        static bool sweepContact(const Vector2 &start, const Vector2 &end,
+            const Vector2 &from, const Vector2 &to, float radius,
+            float *time, Vector2 *normal);
+    };
+
+    /**
+     * Collides the particles of a world with any number of static
+     * platforms. The platforms are held in a bounding volume
+     * hierarchy, so each particle is only tested against the
+     * platforms near it.
+     *
+     * Platforms are added with addPlatform; build must be called
+     * after the last one is added and before contacts are generated.
+     *
+     * As an obstacle, the platforms stop fast particles passing
+     * through them; see ParticleWorld::getObstacles.
+     */
+    class PlatformContacts : public ParticleBatchGenerator<PlatformContacts>,
+                             public ParticleObstacle
+    {
+    public:
+        /** Holds the bounciness of collisions with the platforms. */
+        float restitution;
+
+    protected:
+        /** Holds the platforms. */
+        Segments segments;
+
+        /** Holds the platforms compiled for contact tests. */
+        PlatformSegments compiled;
+
+        /** Holds the hierarchy over the platforms. */
+        SegmentBVH bvh;
+
+    public:
+        /**
+         * Creates an empty set of platforms for the given world.
+         */
+        PlatformContacts(ParticleWorld *world, float restitution = 1.0f);
+
+        /**
+         * Adds a platform from start to end.
+         */
+        void addPlatform(const Vector2 &start, const Vector2 &end);
+
+        /**
+         * Builds the hierarchy over the platforms added so far.
+         */
+        void build();
+
+        /**
+         * Returns the platforms.
+         */
+        const Segments& getSegments() const;
+
+        /**
+         * Returns the platforms compiled for contact tests.
+         */
+        const PlatformSegments& getCompiledSegments() const;
+
+        /**
+         * Returns the hierarchy over the platforms.
+         */
+        const SegmentBVH& getBVH() const;
+
+        /**
+         * Fills the given contact structure with a contact for each
+         * particle of the batch touching a platform.
+         */
+        unsigned addContacts(const ParticleBatch &batch,
+                             ParticleContact *contact, unsigned limit) const;
+
+        /**
+         * Returns the number of platforms, each numbering its
+         * contacts' feature.
+         */
+        unsigned getFeatureCount() const;
+
+        /**
+         * Sweeps a circle against the platforms near its path, and
+         * reports the first one it hits.
+         */
+        virtual bool sweep(const Vector2 &from, const Vector2 &to,
+                           float radius, float *time,
+                           Vector2 *normal) const;
+    };
+
+
+#endif // PLATFORM_H
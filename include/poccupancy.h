@@ -0,0 +1,167 @@
+/*
+ * Interface file for counting the particles in each cell of a grid.
+ *
+ */
+
+#ifndef POCCUPANCY_H
+#define POCCUPANCY_H
+
+#include <vector>
+#include "coreMath.h"
+#include "pstore.h"
+
+
+    /**
+     * Keeps count of the particles in each cell of a grid over the
+     * world, and in any number of rectangular regions of cells, so
+     * that densities can be read at any time without a pass over the
+     * particles.
+     *
+     * The cell each particle was counted in is remembered. The world
+     * updates the occupancy at the end of each step, after the
+     * particles have moved: a particle still in its cell costs a
+     * comparison, and only one that crossed into another cell changes
+     * the counts, of its two cells and of the regions holding them.
+     * Particles outside the grid are counted together, as outside.
+     *
+     * Sleeping particles are not looked at, since they do not move.
+     */
+    class ParticleOccupancy
+    {
+    protected:
+        /**
+         * True if the world should keep the counts up to date.
+         */
+        bool enabled;
+
+        /**
+         * Holds the corner of the grid with the lowest coordinates.
+         */
+        Vector2 origin;
+
+        /**
+         * Holds one over the width and height of a cell.
+         */
+        Vector2 inverseCellSize;
+
+        /**
+         * Holds the number of columns and rows of cells.
+         */
+        unsigned columns;
+        unsigned rows;
+
+        /**
+         * Holds the cell each particle was counted in, or the outside
+         * index, columns * rows, for a particle outside the grid.
+         * Particles not yet counted have no entry.
+         */
+        std::vector<unsigned> particleCells;
+
+        /**
+         * Holds the number of particles in each cell, followed by the
+         * number outside.
+         */
+        std::vector<unsigned> cellCounts;
+
+        /**
+         * Holds the number of particles in each region.
+         */
+        std::vector<unsigned> regionCounts;
+
+        /**
+         * Holds, for each cell, the start of its run of regionIndices;
+         * the run ends where the next cell's starts.
+         */
+        std::vector<unsigned> cellRegionStart;
+
+        /**
+         * Holds the regions each cell lies in, in runs by cell.
+         */
+        std::vector<unsigned> regionIndices;
+
+    public:
+        /**
+         * Creates a disabled occupancy over a single cell.
+         */
+        ParticleOccupancy();
+
+        /**
+         * Turns counting on or off. Turning it on counts every
+         * particle afresh at the end of the next step.
+         */
+        void setEnabled(bool enabled);
+
+        /**
+         * Returns true if counting is on.
+         */
+        bool isEnabled() const;
+
+        /**
+         * Lays the grid over the box from min to max, split into the
+         * given number of columns and rows. Removes every region, and
+         * counts every particle afresh at the end of the next step.
+         */
+        void setGrid(const Vector2 &min, const Vector2 &max,
+                     unsigned columns, unsigned rows);
+
+        /**
+         * Returns the number of columns of cells.
+         */
+        unsigned getColumns() const;
+
+        /**
+         * Returns the number of rows of cells.
+         */
+        unsigned getRows() const;
+
+        /**
+         * Adds a region covering the given number of columns and
+         * rows of cells, starting from the given cell. Returns the
+         * index to query it by.
+         */
+        unsigned addRegion(unsigned column, unsigned row,
+                           unsigned columns, unsigned rows);
+
+        /**
+         * Returns the number of regions.
+         */
+        unsigned getRegionCount() const;
+
+        /**
+         * Returns the number of particles in the given cell.
+         */
+        unsigned getCellCount(unsigned column, unsigned row) const;
+
+        /**
+         * Returns the number of particles in the given region.
+         */
+        unsigned getRegionCount(unsigned region) const;
+
+        /**
+         * Returns the number of particles outside the grid.
+         */
+        unsigned getOutsideCount() const;
+
+        /**
+         * Moves each awake particle of the store that has crossed
+         * into another cell since the last update, and counts those
+         * new to the store. Called by the world after each step.
+         */
+        void update(const ParticleStore &store);
+
+    protected:
+        /**
+         * Returns the cell holding the given position, or the outside
+         * index.
+         */
+        unsigned findCell(float x, float y) const;
+
+        /**
+         * Adds the given amount to the count of the given cell and of
+         * each region it lies in.
+         */
+        void count(unsigned cell, int amount);
+    };
+
+
+#endif // POCCUPANCY_H
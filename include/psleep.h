@@ -0,0 +1,168 @@
+/*
+ * Interface file for putting resting particles to sleep.
+ *
+ */
+
+#ifndef PSLEEP_H
+#define PSLEEP_H
+
+#include <vector>
+#include "pcontacts.h"
+#include "pbroadphase.h"
+
+
+    /**
+     * Puts particles that have come to rest to sleep, so the world
+     * stops integrating them and generating their contacts, and wakes
+     * them again when something touches them.
+     *
+     * A particle is resting once its speed has stayed below the
+     * velocity threshold for a number of frames in a row. Particles
+     * only sleep a whole island at a time: the particles joined by
+     * this frame's contacts are grouped with a union-find, and an
+     * island sleeps when all of its particles are resting. A pile
+     * then never sleeps with one of its particles still settling,
+     * and a particle on top of it is not left hanging in the air.
+     *
+     * The particles of a sleeping island are linked in a ring, so
+     * that waking any one of them wakes them all. An awake particle
+     * that the broadphase finds overlapping a sleeping one wakes its
+     * island before contacts are generated.
+     *
+     * Immovable particles never sleep, and do not join islands: like
+     * the scenery, they hold piles up without linking them.
+     *
+     * Changing a sleeping particle's position or velocity does not
+     * wake it; call wake first.
+     */
+    class ParticleSleep
+    {
+    protected:
+        /**
+         * True if the world should put particles to sleep.
+         */
+        bool enabled;
+
+        /**
+         * Holds the speed below which a particle is resting.
+         */
+        float velocityThreshold;
+
+        /**
+         * Holds the number of frames a particle must rest for before
+         * it can sleep.
+         */
+        unsigned framesToSleep;
+
+        /**
+         * Holds the number of frames each particle has been resting.
+         */
+        std::vector<unsigned> restFrames;
+
+        /**
+         * Holds, for each sleeping particle, the next particle in its
+         * island's ring. An awake particle is a ring of its own.
+         */
+        std::vector<unsigned> next;
+
+        /**
+         * Holds the union-find parent of each particle while islands
+         * are found.
+         */
+        std::vector<unsigned> parent;
+
+        /**
+         * Holds, for the root of each island, the fewest frames any
+         * of its particles has been resting, and the particle its
+         * ring starts at.
+         */
+        std::vector<unsigned> islandRest;
+        std::vector<unsigned> islandRing;
+
+        /**
+         * Holds the number of particles asleep.
+         */
+        unsigned sleepingCount;
+
+    public:
+        /**
+         * Creates a disabled sleep manager with the given threshold
+         * and number of frames.
+         */
+        ParticleSleep(float velocityThreshold = 1.0f,
+                      unsigned framesToSleep = 30);
+
+        /**
+         * Turns sleeping on or off. Turning it off does not wake
+         * particles already asleep; call wakeAll for that.
+         */
+        void setEnabled(bool enabled);
+
+        /**
+         * Returns true if sleeping is on.
+         */
+        bool isEnabled() const;
+
+        /**
+         * Sets the speed below which a particle counts as resting.
+         */
+        void setVelocityThreshold(float velocityThreshold);
+
+        /**
+         * Returns the speed below which a particle counts as resting.
+         */
+        float getVelocityThreshold() const;
+
+        /**
+         * Sets the number of frames a particle must rest for before
+         * it can sleep.
+         */
+        void setFramesToSleep(unsigned framesToSleep);
+
+        /**
+         * Returns the number of frames a particle must rest for.
+         */
+        unsigned getFramesToSleep() const;
+
+        /**
+         * Returns the number of particles asleep.
+         */
+        unsigned getSleepingCount() const;
+
+        /**
+         * Wakes the particle at the given index of the store, and
+         * every other particle in its island.
+         */
+        void wake(ParticleStore &store, unsigned index);
+
+        /**
+         * Wakes every particle in the store.
+         */
+        void wakeAll(ParticleStore &store);
+
+        /**
+         * Wakes the island of any sleeping particle paired with an
+         * awake one, until no pair is left half asleep, then removes
+         * the pairs that are wholly asleep. Call after the broadphase.
+         */
+        void wakeTouched(ParticleStore &store, ParticlePairs &pairs);
+
+        /**
+         * Counts the frames each awake particle has been resting,
+         * finds the islands joined by the given contacts, and puts to
+         * sleep those whose particles have all rested long enough.
+         * Call at the end of the step.
+         */
+        void update(ParticleStore &store, const ParticleContact *contacts,
+                    unsigned count);
+
+    protected:
+        /**
+         * Returns the root of the particle's island, flattening the
+         * path to it.
+         */
+        unsigned findRoot(unsigned index);
+    };
+
+
+#endif // PSLEEP_H
@@ -0,0 +1,151 @@
+/*
+ * Interface file for the fixed-timestep driver of a particle world.
+ *
+ */
+
+#ifndef PSTEP_H
+#define PSTEP_H
+
+#include <vector>
+#include <chrono>
+#include "pworld.h"
+
+
+    /**
+     * Steps a particle world at a fixed rate, whatever rate it is
+     * called at.
+     *
+     * Each call to advance adds the real time since the last call,
+     * measured with a steady clock, to an accumulator, and runs as
+     * many whole steps of the fixed size as the accumulator holds.
+     * The simulation then keeps to real time however fast frames are
+     * drawn, and a slow frame is caught up over the next call.
+     *
+     * Catching up is capped at a number of steps per call. Past that,
+     * the time left over is dropped, so a frame that takes longer
+     * than the steps it runs cannot make the next one longer still.
+     *
+     * What is left in the accumulator, as a fraction of a step, is
+     * the interpolation alpha. Drawing each particle that far between
+     * its position before the last step and its position now hides
+     * the steps landing unevenly on frames.
+     */
+    class ParticleStepper
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+    protected:
+        /**
+         * Holds the world being stepped.
+         */
+        ParticleWorld *world;
+
+        /**
+         * Holds the duration of each step, in seconds.
+         */
+        float stepSize;
+
+        /**
+         * Holds the most steps run by one call to advance.
+         */
+        unsigned maxSteps;
+
+        /**
+         * Holds the real time not yet simulated, in seconds.
+         */
+        double accumulator;
+
+        /**
+         * Holds the time simulated, and the time dropped because
+         * catching up hit the cap, in seconds.
+         */
+        double simulatedTime;
+        double droppedTime;
+
+        /**
+         * Holds when advance was last called. started is false until
+         * the first call.
+         */
+        Clock::time_point lastTime;
+        bool started;
+
+        /**
+         * Holds the particle positions before the last step.
+         */
+        std::vector<float> previousX;
+        std::vector<float> previousY;
+
+    public:
+        /**
+         * Creates a driver for the given world, taking steps of the
+         * given size and at most maxSteps of them per call.
+         */
+        ParticleStepper(ParticleWorld *world, float stepSize = 0.01f,
+                        unsigned maxSteps = 5);
+
+        /**
+         * Sets the duration of each step, in seconds.
+         */
+        void setStepSize(float stepSize);
+
+        /**
+         * Returns the duration of each step, in seconds.
+         */
+        float getStepSize() const;
+
+        /**
+         * Sets the most steps run by one call to advance.
+         */
+        void setMaxSteps(unsigned maxSteps);
+
+        /**
+         * Returns the most steps run by one call to advance.
+         */
+        unsigned getMaxSteps() const;
+
+        /**
+         * Measures the real time since the last call and simulates
+         * it. The first call only starts the clock. Returns the
+         * number of steps run.
+         */
+        unsigned advance();
+
+        /**
+         * Simulates the given number of seconds, as advance does with
+         * the time it measures. Returns the number of steps run.
+         */
+        unsigned advance(double elapsed);
+
+        /**
+         * Empties the accumulator and restarts the clock, e.g. after
+         * the simulation was paused.
+         */
+        void reset();
+
+        /**
+         * Returns the fraction of a step, from 0 to 1, that has
+         * passed since the last step.
+         */
+        float getAlpha() const;
+
+        /**
+         * Returns the position of the given particle, interpolated
+         * by the alpha between before and after the last step.
+         */
+        Vector2 getInterpolatedPosition(const Particle *particle) const;
+
+        /**
+         * Returns the time simulated, in seconds.
+         */
+        double getSimulatedTime() const;
+
+        /**
+         * Returns the real time dropped because catching up hit the
+         * cap, in seconds.
+         */
+        double getDroppedTime() const;
+    };
+
+
+#endif // PSTEP_H
@@ -0,0 +1,90 @@
+/*
+ * Interface file for the structure-of-arrays particle storage.
+ *
+ */
+
+#ifndef PSTORE_H
+#define PSTORE_H
+
+#include <vector>
+
+
+    /**
+     * Holds the state of every particle in a world as a set of
+     * parallel arrays, one per scalar quantity. A particle is an
+     * index into these arrays, so passes over the whole world (such
+     * as integration or contact generation) stream linearly through
+     * memory instead of chasing a pointer per particle.
+     *
+     * The arrays are public so that batch kernels can work on them
+     * directly; individual particles should normally be accessed
+     * through a Particle handle.
+     */
+    class ParticleStore
+    {
+    public:
+        typedef std::vector<float> Channel;
+
+        /** Holds the position of each particle. */
+        Channel positionX;
+        Channel positionY;
+
+        /** Holds the linear velocity of each particle. */
+        Channel velocityX;
+        Channel velocityY;
+
+        /** Holds the constant acceleration (e.g. gravity) of each particle. */
+        Channel accelerationX;
+        Channel accelerationY;
+
+        /** Holds the force accumulated for the next integration step. */
+        Channel forceX;
+        Channel forceY;
+
+        /**
+         * Holds the inverse of the mass of each particle. Zero is an
+         * immovable particle.
+         */
+        Channel inverseMass;
+
+        /** Holds the amount of damping applied to linear motion. */
+        Channel damping;
+
+        /** Holds the collision radius of each particle. */
+        Channel radius;
+
+        /**
+         * Holds whether each particle is awake. Sleeping particles
+         * are skipped by integration and contact generation; see
+         * ParticleSleep.
+         */
+        std::vector<unsigned char> awake;
+
+    public:
+        /**
+         * Appends a new particle at rest at the origin and returns
+         * its index.
+         */
+        unsigned add();
+
+        /**
+         * Returns the number of particles held.
+         */
+        unsigned size() const;
+
+        /**
+         * Reserves room for the given number of particles so that
+         * adding up to that many does not reallocate.
+         */
+        void reserve(unsigned count);
+
+        /**
+         * Integrates the particle at the given index forward in time
+         * by the given duration. Whole-store integration is done by
+         * ParticleIntegrator.
+         */
+        void integrate(unsigned index, float duration);
+    };
+
+
+#endif // PSTORE_H
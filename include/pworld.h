@@ -6,20 +6,134 @@
 
 #include <vector> 
 #include "pcontacts.h"
+#include "parena.h"
+#include "pcache.h"
+#include "pintegrate.h"
+#include "pbroadphase.h"
+#include "pcolored.h"
+#include "psleep.h"
+#include "poccupancy.h"
 
 
+    /**
+     * What the last step of a particle world cost. Times are in
+     * seconds. Each phase method records its own figures, so the
+     * stats are filled in whether the step was run by runPhysics or
+     * phase by phase. When runPhysics takes several substeps, the
+     * times and counts are totals over them.
+     *
+     * Recording costs a few clock reads per step. Define
+     * PWORLD_NO_STATS to compile it out; the stats then stay zero.
+     */
+    struct ParticleStepStats
+    {
+        /** Holds the time taken by the whole of runPhysics. */
+        double stepTime;
+
+        /** Holds the time taken to integrate the particles. */
+        double integrateTime;
+
+        /** Holds the time taken by the broadphase. */
+        double broadphaseTime;
+
+        /** Holds the time taken to generate all the contacts. */
+        double generateTime;
+
+        /**
+         * Holds the time taken by each contact generator, in the
+         * order they are registered. When the generators run
+         * concurrently these overlap, and add up to more than
+         * generateTime.
+         */
+        std::vector<double> generatorTime;
+
+        /** Holds the time taken to resolve the contacts. */
+        double resolveTime;
+
+        /**
+         * Holds the time taken to correct interpenetration, which is
+         * zero while the position corrector is off.
+         */
+        double correctTime;
+
+        /**
+         * Holds the time taken to find islands and put them to
+         * sleep, which is zero while sleeping is off.
+         */
+        double sleepTime;
+
+        /**
+         * Holds the time taken to update the occupancy counts, which
+         * is zero while they are off.
+         */
+        double occupancyTime;
+
+        /** Holds the number of contacts kept for resolution. */
+        unsigned contactsGenerated;
+
+        /**
+         * Holds the number of contacts generated that were seen not
+         * to fit under the contact arena's cap. Generators stop at
+         * the room they are given, so only one contact past it is
+         * seen for each generator cut short: this is a lower bound on
+         * what was lost, and the same with one thread or many.
+         */
+        unsigned contactsDropped;
+
+        /**
+         * True if a generator was cut short by the contact arena's
+         * cap during the step.
+         */
+        bool overflowed;
+
+        /** Holds the number of iterations the resolver used. */
+        unsigned iterationsUsed;
+
+        /**
+         * Holds the number of contacts whose geometry was reused
+         * from the last frame by the contact cache.
+         */
+        unsigned contactsReused;
+
+        /** Holds the number of particles asleep after the step. */
+        unsigned particlesAsleep;
+
+        /**
+         * Holds the number of particles swept against the obstacles,
+         * and the number of those stopped at an impact.
+         */
+        unsigned particlesSwept;
+        unsigned particlesStopped;
+
+        /** Holds the number of substeps runPhysics took. */
+        unsigned substeps;
+    };
+
     class ParticleWorld
     {
     public:
         typedef std::vector<Particle*> Particles;
         typedef std::vector<ParticleContactGenerator*> ContactGenerators;
+        typedef std::vector<ParticleObstacle*> Obstacles;
 
     protected:
         /**
-         * Holds the particles
+         * Holds the state of every particle in the world, laid out
+         * as a structure of arrays.
+         */
+        ParticleStore store;
+
+        /**
+         * Holds the handles to the particles. The handle at position
+         * i refers to slot i of the store. The world owns the handles.
          */
         Particles particles;
 
+        /**
+         * Holds the integrator that advances the particle store.
+         */
+        ParticleIntegrator integrator;
+
         /**
          * True if the world should calculate the number of iterations
          * to give the contact resolver at each frame.
@@ -37,21 +151,118 @@
         ContactGenerators contactGenerators;
 
         /**
-         * Holds the list of contacts.
+         * Holds the scenery fast particles are swept against.
+         */
+        Obstacles obstacles;
+
+        /**
+         * Holds the fraction of its radius a particle must move in a
+         * step to be swept against the obstacles, or zero to sweep
+         * none.
+         */
+        float sweepThreshold;
+
+        /**
+         * Holds the particles being swept this step, and where they
+         * started.
          */
-        ParticleContact *contacts;
+        std::vector<unsigned> sweptParticles;
+        std::vector<Vector2> sweptFrom;
 
         /**
-         * Holds the maximum number of contacts allowed (i.e. the
-         * size of the contacts array).
+         * Holds the most substeps runPhysics may split a step into,
+         * and the fraction of the smallest radius the fastest
+         * particle may move in each.
          */
-        unsigned maxContacts;
+        unsigned maxSubsteps;
+        float courantNumber;
+
+        /**
+         * Holds the parallel resolver to use instead of the serial
+         * one, or NULL.
+         */
+        ParticleColoredResolver *coloredResolver;
+
+        /**
+         * Holds the broadphase used to find overlapping particles, or
+         * NULL if the world does not need particle pairs.
+         */
+        ParticleBroadphase *broadphase;
+
+        /**
+         * Holds the overlapping particle pairs found this step.
+         */
+        ParticlePairs pairs;
+
+        /**
+         * Holds the contacts generated this step.
+         */
+        ParticleContactArena contacts;
+
+        /**
+         * Holds the contacts of the last step, for warm starting.
+         */
+        ParticleContactCache cache;
+
+        /**
+         * Holds the pass that pushes interpenetrating particles apart
+         * after resolution.
+         */
+        ParticlePositionCorrector corrector;
+
+        /**
+         * Holds the sleep state of the particles' islands.
+         */
+        ParticleSleep sleep;
+
+        /**
+         * Holds the count of particles in each cell of a grid.
+         */
+        ParticleOccupancy occupancy;
+
+        /**
+         * Holds the grid that answers proximity queries, and whether
+         * it was built since the particles last moved.
+         */
+        ParticleHashGrid queryGrid;
+        bool queryGridCurrent;
+
+        /**
+         * Holds the pool the step is spread over, or NULL when the
+         * world runs on the calling thread only. The world owns it.
+         */
+        ThreadPool *threadPool;
+
+        /**
+         * Holds a contact buffer for each generator, used when the
+         * generators run concurrently. Each is capped at the contact
+         * arena's cap, since any one generator may fill it.
+         */
+        std::vector<ParticleContactArena> generatorContacts;
+
+        /**
+         * Holds the number of contacts each generator wrote into its
+         * buffer.
+         */
+        std::vector<unsigned> generatorUsed;
+
+        /**
+         * Holds each generator arena's overflow count before this
+         * step's generation.
+         */
+        std::vector<unsigned> generatorOverflows;
+
+        /**
+         * Holds the cost of the last step.
+         */
+        ParticleStepStats stats;
 
     public:
 
         /**
-         * Creates a new particle simulator that can handle up to the
-         * given number of contacts per frame. 
+         * Creates a new particle simulator with room for the given
+         * number of contacts per frame. The room grows when a frame
+         * needs more; see getContactArena to cap it.
          */
         ParticleWorld(unsigned maxContacts, unsigned iterations=0);
 
@@ -67,26 +278,255 @@
         unsigned generateContacts();
 
         /**
-         * Integrates all the particles in this world forward in time
-         * by the given duration.
+         * Integrates all the awake particles in this world forward in
+         * time by the given duration.
          */
         void integrate(float duration);
 
         /**
-         * Processes all the physics for the particle world.
+         * Asks the broadphase, if there is one, for the pairs of
+         * particles that overlap. Called every step by runPhysics.
+         * When sleeping is on, this wakes the sleeping particles an
+         * awake one overlaps, and drops the pairs left asleep.
+         */
+        void findPairs();
+
+        /**
+         * Resolves the first usedContacts contacts written by the
+         * last call to generateContacts. Called every step by
+         * runPhysics.
+         */
+        void resolveContacts(unsigned usedContacts, float duration);
+
+        /**
+         * Processes all the physics for the particle world. With
+         * substepping on, the duration is split into as many equal
+         * substeps as the fastest particle needs; see
+         * setMaxSubsteps. Returns the number of substeps taken.
+         */
+        unsigned runPhysics(float duration);
+
+        /**
+         * Sets the most substeps runPhysics may split a step into.
+         * One, the default, turns substepping off.
+         */
+        void setMaxSubsteps(unsigned maxSubsteps);
+
+        /**
+         * Returns the most substeps runPhysics may take.
+         */
+        unsigned getMaxSubsteps() const;
+
+        /**
+         * Sets the fraction of the smallest particle radius that the
+         * fastest awake particle may move in one substep. runPhysics
+         * takes the fewest substeps, up to the maximum, that keep to
+         * it, so calm frames take one step and violent ones several.
+         */
+        void setCourantNumber(float courantNumber);
+
+        /**
+         * Returns the fraction of the smallest radius a particle may
+         * move in one substep.
+         */
+        float getCourantNumber() const;
+
+        /**
+         * Returns the number of substeps a step of the given duration
+         * would be split into now.
+         */
+        unsigned calculateSubsteps(float duration) const;
+
+        /**
+         * Adds a new particle to the world and returns its handle.
+         * The handle remains valid for the lifetime of the world.
+         */
+        Particle* createParticle();
+
+        /**
+         * Reserves room for the given number of particles.
          */
-        void runPhysics(float duration);
+        void reserveParticles(unsigned count);
 		
         /**
          *  Returns the list of particles.
          */
         Particles& getParticles();
 
+        /**
+         * Returns the storage holding the state of all particles.
+         */
+        ParticleStore& getStore();
+
+        /**
+         * Returns the contact resolver, e.g. to select its mode.
+         */
+        ParticleContactResolver& getResolver();
+
+        /**
+         * Sets a parallel resolver to use in place of the serial one.
+         * The world does not take ownership. Pass NULL to go back to
+         * the serial resolver.
+         */
+        void setColoredResolver(ParticleColoredResolver *coloredResolver);
+
+        /**
+         * Returns the integrator, e.g. to select a kernel.
+         */
+        ParticleIntegrator& getIntegrator();
+
         /**
          * Returns the list of contact generators.
          */
         ContactGenerators& getContactGenerators();
 
+        /**
+         * Returns the list of obstacles fast particles are swept
+         * against. The world does not take ownership.
+         */
+        Obstacles& getObstacles();
+
+        /**
+         * Sets how far, as a fraction of its radius, a particle must
+         * move in a step to be swept against the obstacles. A swept
+         * particle that would hit one is stopped where it first
+         * touches, just inside it, so the contact generators find the
+         * contact there instead of the particle passing through.
+         * Zero, the default, sweeps nothing.
+         */
+        void setSweepThreshold(float sweepThreshold);
+
+        /**
+         * Returns the fraction of its radius a particle must move to
+         * be swept.
+         */
+        float getSweepThreshold() const;
+
+        /**
+         * Sets the broadphase the world rebuilds each step. The world
+         * does not take ownership. Pass NULL to disable pair finding.
+         */
+        void setBroadphase(ParticleBroadphase *broadphase);
+
+        /**
+         * Returns the contact arena, e.g. to cap its growth.
+         *
+         * With more than one thread, each generator first writes into
+         * an arena of its own, and the cap applies to each of these
+         * as well as to the contacts kept. A world with n generators
+         * may then hold up to n + 1 times the cap in contacts.
+         */
+        ParticleContactArena& getContactArena();
+
+        /**
+         * Returns the contact cache, e.g. to turn on warm starting.
+         */
+        ParticleContactCache& getContactCache();
+
+        /**
+         * Returns the position corrector, e.g. to turn it on.
+         */
+        ParticlePositionCorrector& getPositionCorrector();
+
+        /**
+         * Returns the sleep manager, e.g. to turn sleeping on or to
+         * wake a particle before moving it.
+         */
+        ParticleSleep& getSleep();
+
+        /**
+         * Returns the occupancy counts, e.g. to lay out their grid
+         * and turn them on.
+         */
+        ParticleOccupancy& getOccupancy();
+
+        /**
+         * Returns the pairs of overlapping particles found in the
+         * last step.
+         */
+        const ParticlePairs& getPairs() const;
+
+        /**
+         * Replaces the contents of the given list with every pair of
+         * particles whose centres are closer than the given distance,
+         * whatever their radii, e.g. to draw links between nearby
+         * particles.
+         *
+         * The queries share a grid of cells about the distance
+         * across, built on the first query after the particles move
+         * and reused until they do again, so any number of queries
+         * between steps cost one build. Move particles by hand
+         * between queries and the grid will not see it until the
+         * next step.
+         */
+        void findPairsWithin(float distance, ParticlePairs &pairs);
+
+        /**
+         * Replaces the contents of the given list with the index of
+         * every particle whose centre is closer than the given
+         * distance to the point. Uses the same grid as
+         * findPairsWithin.
+         */
+        void findNeighbours(const Vector2 &point, float distance,
+                            std::vector<unsigned> &neighbours);
+
+        /**
+         * Sets the number of threads the step runs on, including the
+         * calling thread. Zero uses one per hardware thread. With one
+         * thread the step runs exactly as it always has; with more,
+         * integration and pair finding are split into chunks and the
+         * contact generators run concurrently. The contacts produced
+         * are the same either way.
+         */
+        void setThreadCount(unsigned threads);
+
+        /**
+         * Returns the number of threads the step runs on.
+         */
+        unsigned getThreadCount() const;
+
+        /**
+         * Returns the world's thread pool, or NULL if it runs on one
+         * thread. Can be shared with a parallel resolver.
+         *
+         * The pool is replaced by setThreadCount and deleted with the
+         * world, so the pointer is only valid until either happens.
+         * setThreadCount moves the world's coloured resolver onto the
+         * new pool if it was sharing the old one; anything else
+         * holding the pointer must fetch it again.
+         */
+        ThreadPool* getThreadPool();
+
+        /**
+         * Returns what the last step cost.
+         */
+        const ParticleStepStats& getStepStats() const;
+
+    protected:
+        /**
+         * Runs every phase of one step of the given duration.
+         */
+        void step(float duration);
+
+        /**
+         * Records the awake particles about to move further than the
+         * sweep threshold in a step of the given duration, and where
+         * they are. Called before integration.
+         */
+        void findFastParticles(float duration);
+
+        /**
+         * Sweeps the recorded particles from where they were to where
+         * integration took them, and stops any that hit an obstacle.
+         */
+        void sweepFastParticles();
+
+        /**
+         * Rebuilds the query grid with cells of the given size unless
+         * it is current and its cells are between the given bounds.
+         */
+        void updateQueryGrid(float cellSize, float minCellSize,
+                             float maxCellSize);
     };
 
 
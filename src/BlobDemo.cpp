@@ -3,6 +3,9 @@
 #include "coreMath.h"       // Core mathematical functions and vector operations
 #include "pcontacts.h"      // Particle contact resolution for collision handling
 #include "pworld.h"         // Particle world managing physics and interactions
+#include "pcollisions.h"    // Contact generator for blob-to-blob collisions
+#include "platform.h"       // Static platforms the blobs bounce off
+#include "pstep.h"          // Fixed-rate stepping of the world
 #include <vector>           // STL vector for dynamic array management
 #include <cassert>          // Assertion library for debugging
 #include <iostream>         // Standard I/O stream for debugging and logging
@@ -15,93 +18,22 @@ const Vector2 Vector2::GRAVITY = Vector2(0, -9.81);
 #define BLOB_COUNT 50    
 #define PLATFORM_COUNT 15  
 
-// Represents a static platform where blobs can collide and bounce
-class Platform : public ParticleContactGenerator
-{
-public:
-    Vector2 start;  // Starting point of the platform
-    Vector2 end;    // Ending point of the platform
-
-    std::vector<Particle*> particles;  // Particles that interact with this platform
-
-    // Detects and resolves collisions between particles and the platform
-    unsigned addContact(ParticleContact* contact, unsigned limit) const override;
-};
-
-unsigned Platform::addContact(ParticleContact* contact, unsigned limit) const
-{
-    const static float restitution = 1.0f;  // Defines the bounciness of collisions
-    unsigned used = 0;  // Counter for detected collisions
-
-    for (Particle* particle : particles)
-    {
-        if (used >= limit) return used;  // Stop if contact limit is reached
-
-        Vector2 toParticle = particle->getPosition() - start;
-        Vector2 lineDirection = end - start;
-
-        float projected = toParticle * lineDirection;
-        float platformSqLength = lineDirection.squareMagnitude();
-        float squareRadius = particle->getRadius() * particle->getRadius();
-
-        // Check if the particle is near the platform's start point
-        if (projected <= 0)
-        {
-            if (toParticle.squareMagnitude() < squareRadius)  // Collision detected
-            {
-                contact->contactNormal = toParticle.unit();
-                contact->restitution = restitution;
-                contact->particle[0] = particle;
-                contact->particle[1] = nullptr;
-                contact->penetration = particle->getRadius() - toParticle.magnitude();
-                used++;
-                contact++;
-            }
-        }
-        // Check if the particle is near the platform's end point
-        else if (projected >= platformSqLength)
-        {
-            toParticle = particle->getPosition() - end;
-            if (toParticle.squareMagnitude() < squareRadius)  // Collision detected
-            {
-                contact->contactNormal = toParticle.unit();
-                contact->restitution = restitution;
-                contact->particle[0] = particle;
-                contact->particle[1] = nullptr;
-                contact->penetration = particle->getRadius() - toParticle.magnitude();
-                used++;
-                contact++;
-            }
-        }
-        // Check if the particle is between the start and end points
-        else
-        {
-            float distanceToPlatform = toParticle.squareMagnitude() - projected * projected / platformSqLength;
-            if (distanceToPlatform < squareRadius)  // Collision detected
-            {
-                Vector2 closestPoint = start + lineDirection * (projected / platformSqLength);
-                contact->contactNormal = (particle->getPosition() - closestPoint).unit();
-                contact->restitution = restitution;
-                contact->particle[0] = particle;
-                contact->particle[1] = nullptr;
-                contact->penetration = particle->getRadius() - sqrt(distanceToPlatform);
-                used++;
-                contact++;
-            }
-        }
-    }
-    return used;  // Return the number of detected collisions
-}
-
+// Seconds of simulated time between reports to the console
+#define REPORT_INTERVAL 1.0f
 
 class BlobDemo : public Application
 {
-    Particle* blobs[BLOB_COUNT];   // Array of blobs (particles) in the simulation
-    Platform* platforms;           // Array of platforms for collision detection
+    Particle* blobs[BLOB_COUNT];   // Handles to the blobs (particles) owned by the world
+    ParticleHashGrid broadphase;   // Finds overlapping blobs each step
     ParticleWorld world;           // Manages physics updates for particles
+    ParticleCollisions collisions; // Generates contacts between overlapping blobs
+    PlatformContacts platforms;    // Static platforms for collision detection
+    ParticleStepper stepper;       // Steps the world at a fixed rate in real time
+    ParticlePairs links;           // Pairs of blobs close enough to be linked
 
 private:
     float totalPhysicsTime = 0.0f; // Tracks total simulation time
+    float lastReportTime = 0.0f;   // Simulation time of the last console report
 
 public:
     BlobDemo();    // Constructor to initialize blobs, platforms, and physics
@@ -110,13 +42,14 @@ public:
     virtual const char* getTitle();  // Returns the title of the simulation window
     virtual void display();          // Handles rendering of objects in OpenGL
     virtual void update();           // Updates physics and animation per frame
-    void handleBlobCollision();      // Detects and resolves blob-to-blob collisions
     void drawBlobConnections();      // Draws lines between nearby blobs
-    void countBlobsInGrid();         // Counts blobs in different quadrants
+    void countBlobsInGrid();         // Prints the blob counts of the quadrants
 };
 
 // Method definitions
-BlobDemo::BlobDemo() : world(PLATFORM_COUNT + BLOB_COUNT, PLATFORM_COUNT)
+BlobDemo::BlobDemo()
+    : world(PLATFORM_COUNT + BLOB_COUNT * 2), collisions(&world), platforms(&world),
+      stepper(&world, 0.01f)
 {
     width = 400;
     height = 400;
@@ -124,9 +57,26 @@ BlobDemo::BlobDemo() : world(PLATFORM_COUNT + BLOB_COUNT, PLATFORM_COUNT)
 
     float margin = 0.95f;
 
+    // Let the world find overlapping blobs every step
+    world.setBroadphase(&broadphase);
+
+    // Push apart blobs that still overlap after their contacts are resolved
+    world.getPositionCorrector().setEnabled(true);
+
+    // Keep count of the blobs in an 8x8 grid over the arena, and in each
+    // quadrant of it, as they move
+    ParticleOccupancy& occupancy = world.getOccupancy();
+    occupancy.setGrid(Vector2(-nRange, -nRange), Vector2(nRange, nRange), 8, 8);
+    occupancy.addRegion(0, 4, 4, 4);  // Upper-left quadrant
+    occupancy.addRegion(4, 4, 4, 4);  // Upper-right quadrant
+    occupancy.addRegion(0, 0, 4, 4);  // Lower-left quadrant
+    occupancy.addRegion(4, 0, 4, 4);  // Lower-right quadrant
+    occupancy.setEnabled(true);
+
     // Create the blobs with unique positions, velocities, and properties
+    world.reserveParticles(BLOB_COUNT);
     for (unsigned i = 0; i < BLOB_COUNT; i++) {
-        blobs[i] = new Particle;
+        blobs[i] = world.createParticle();
         blobs[i]->setPosition(-60.0 + (i % 5) * 40.0, 90.0 - (i / 5) * 30.0);
         blobs[i]->setRadius(3);
         blobs[i]->setVelocity(100.0, 200.0);  // Set initial velocity
@@ -134,71 +84,70 @@ BlobDemo::BlobDemo() : world(PLATFORM_COUNT + BLOB_COUNT, PLATFORM_COUNT)
         blobs[i]->setAcceleration(Vector2::GRAVITY * 5.0f * ((i % 5) + 1));
         blobs[i]->setMass(100.0f);
         blobs[i]->clearAccumulator();        // Reset forces applied to the blob
-        world.getParticles().push_back(blobs[i]);
     }
 
     // Create platforms (static boundaries)
-    platforms = new Platform[PLATFORM_COUNT];
-
     // Vertical platforms
-    platforms[0].start = Vector2(0.0, 0.0);
-    platforms[0].end = Vector2(0.0, -50.0);
+    platforms.addPlatform(Vector2(0.0, 0.0),
+        Vector2(0.0, -50.0));
 
-    platforms[1].start = Vector2(-nRange * margin, -nRange * margin);
-    platforms[1].end = Vector2(-nRange * margin, nRange * margin);
+    platforms.addPlatform(Vector2(-nRange * margin, -nRange * margin),
+        Vector2(-nRange * margin, nRange * margin));
 
-    platforms[2].start = Vector2(nRange * margin, -nRange * margin);
-    platforms[2].end = Vector2(nRange * margin, nRange * margin);
+    platforms.addPlatform(Vector2(nRange * margin, -nRange * margin),
+        Vector2(nRange * margin, nRange * margin));
 
     // Horizontal platforms
-    platforms[3].start = Vector2(-nRange * margin, -nRange * margin);
-    platforms[3].end = Vector2(nRange * margin, -nRange * margin);
+    platforms.addPlatform(Vector2(-nRange * margin, -nRange * margin),
+        Vector2(nRange * margin, -nRange * margin));
 
-    platforms[4].start = Vector2(-nRange * margin, nRange * margin);
-    platforms[4].end = Vector2(nRange * margin, nRange * margin);
+    platforms.addPlatform(Vector2(-nRange * margin, nRange * margin),
+        Vector2(nRange * margin, nRange * margin));
 
     // Additional diagonal and vertical platforms for more interaction
-    platforms[5].start = Vector2(-50.0, 50.0);
-    platforms[5].end = Vector2(0.0, 0.0);
+    platforms.addPlatform(Vector2(-50.0, 50.0),
+        Vector2(0.0, 0.0));
 
-    platforms[6].start = Vector2(50.0, 50.0);
-    platforms[6].end = Vector2(0.0, 0.0);
+    platforms.addPlatform(Vector2(50.0, 50.0),
+        Vector2(0.0, 0.0));
 
-    platforms[7].start = Vector2(-50.0, -50.0);
-    platforms[7].end = Vector2(0.0, 0.0);
+    platforms.addPlatform(Vector2(-50.0, -50.0),
+        Vector2(0.0, 0.0));
 
-    platforms[8].start = Vector2(50.0, -50.0);
-    platforms[8].end = Vector2(0.0, 0.0);
+    platforms.addPlatform(Vector2(50.0, -50.0),
+        Vector2(0.0, 0.0));
 
     // Additional vertical platforms in the middle
-    platforms[9].start = Vector2(-30.0, -nRange * margin);
-    platforms[9].end = Vector2(-30.0, nRange * margin);
+    platforms.addPlatform(Vector2(-30.0, -nRange * margin),
+        Vector2(-30.0, nRange * margin));
 
-    platforms[10].start = Vector2(30.0, -nRange * margin);
-    platforms[10].end = Vector2(30.0, nRange * margin);
+    platforms.addPlatform(Vector2(30.0, -nRange * margin),
+        Vector2(30.0, nRange * margin));
 
     // Additional horizontal platforms in the middle
-    platforms[11].start = Vector2(-nRange * margin, -30.0);
-    platforms[11].end = Vector2(nRange * margin, -30.0);
+    platforms.addPlatform(Vector2(-nRange * margin, -30.0),
+        Vector2(nRange * margin, -30.0));
 
-    platforms[12].start = Vector2(-nRange * margin, 30.0);
-    platforms[12].end = Vector2(nRange * margin, 30.0);
+    platforms.addPlatform(Vector2(-nRange * margin, 30.0),
+        Vector2(nRange * margin, 30.0));
 
     // Diagonal platforms to create more dynamic interactions
-    platforms[13].start = Vector2(-nRange * margin, -nRange * margin);
-    platforms[13].end = Vector2(nRange * margin, nRange * margin);
+    platforms.addPlatform(Vector2(-nRange * margin, -nRange * margin),
+        Vector2(nRange * margin, nRange * margin));
 
-    platforms[14].start = Vector2(-nRange * margin, nRange * margin);
-    platforms[14].end = Vector2(nRange * margin, -nRange * margin);
+    platforms.addPlatform(Vector2(-nRange * margin, nRange * margin),
+        Vector2(nRange * margin, -nRange * margin));
 
-    // Assign blobs to platforms for collision detection
-    for (unsigned i = 0; i < PLATFORM_COUNT; i++)
-    {
-        for (unsigned j = 0; j < BLOB_COUNT; j++) {
-            platforms[i].particles.push_back(blobs[j]);
-        }
-        world.getContactGenerators().push_back(&platforms[i]);
-    }
+    // Let the platforms collide with the world's blobs
+    platforms.build();
+    world.getContactGenerators().push_back(&platforms);
+
+    // Stop blobs moving more than half their radius a step from passing through a platform
+    world.getObstacles().push_back(&platforms);
+    world.setSweepThreshold(0.5f);
+
+    // Resolve blob-to-blob collisions alongside the platform contacts
+    world.getContactGenerators().push_back(&collisions);
 }
 
 void BlobDemo::display()
@@ -210,10 +159,11 @@ void BlobDemo::display()
     glBegin(GL_LINES);
     glColor3f(0, 1, 1); // Set platform color to cyan
 
-    for (unsigned i = 0; i < PLATFORM_COUNT; i++)
+    const Segments& segments = platforms.getSegments();
+    for (unsigned i = 0; i < segments.size(); i++)
     {
-        const Vector2& p0 = platforms[i].start;
-        const Vector2& p1 = platforms[i].end;
+        const Vector2& p0 = segments[i].start;
+        const Vector2& p1 = segments[i].end;
         glVertex2f(p0.x, p0.y);
         glVertex2f(p1.x, p1.y);
     }
@@ -241,7 +191,8 @@ void BlobDemo::display()
         case 9: glColor3f(0.5f, 1.0f, 0.5f); break; // Light Green
         }
 
-        const Vector2& p = blobs[i]->getPosition();
+        // Draw the blob between its last two steps, as far as real time has got
+        const Vector2& p = stepper.getInterpolatedPosition(blobs[i]);
 
         glPushMatrix();
         glTranslatef(p.x, p.y, 0); // Move blob to its position
@@ -255,65 +206,23 @@ void BlobDemo::display()
 
 
 
-void BlobDemo::handleBlobCollision()
-{
-    // Loop through all blobs to check for collisions
-    for (unsigned i = 0; i < BLOB_COUNT - 1; i++) {
-        for (unsigned j = i + 1; j < BLOB_COUNT; j++) {
-
-            // Compute the vector between two blobs
-            Vector2 distanceVec = blobs[j]->getPosition() - blobs[i]->getPosition();
-            float distance = distanceVec.magnitude();
-            float combinedRadius = blobs[i]->getRadius() + blobs[j]->getRadius();
-
-            // Check if blobs are colliding
-            if (distance < combinedRadius) {
-                Vector2 normal = distanceVec.unit(); // Normalize direction of collision
-                Vector2 relativeVelocity = blobs[j]->getVelocity() - blobs[i]->getVelocity();
-                float velocityAlongNormal = relativeVelocity * normal;
-
-                // Skip if blobs are moving apart
-                if (velocityAlongNormal > 0) continue;
-
-                float e = 1.0f; // Perfectly elastic collision (coefficient of restitution)
-                float m1 = blobs[i]->getMass();
-                float m2 = blobs[j]->getMass();
-
-                // Calculate impulse magnitude
-                float impulse = (-(1 + e) * velocityAlongNormal) / (1 / m1 + 1 / m2);
-                Vector2 impulseVec = normal * impulse;
-
-                // Apply impulse to adjust velocities after collision
-                blobs[i]->setVelocity(blobs[i]->getVelocity() - (impulseVec * (1.0f / m1)));
-                blobs[j]->setVelocity(blobs[j]->getVelocity() + (impulseVec * (1.0f / m2)));
-            }
-        }
-    }
-}
-
-
 void BlobDemo::drawBlobConnections()
 {
+    // Find the blobs within a certain distance of each other
+    world.findPairsWithin(80.0f, links);
+    const ParticleWorld::Particles& particles = world.getParticles();
+
     glColor3f(1, 1, 1); // Set color to white for the connection lines
     glBegin(GL_LINES);   // Start drawing lines
 
-    // Iterate through all blobs to check for nearby connections
-    for (unsigned i = 0; i < BLOB_COUNT - 1; i++)
+    for (unsigned i = 0; i < links.size(); i++)
     {
-        for (unsigned j = i + 1; j < BLOB_COUNT; j++)
-        {
-            Vector2 pos1 = blobs[i]->getPosition();
-            Vector2 pos2 = blobs[j]->getPosition();
+        // Join the blobs where they are drawn, not where they were stepped to
+        Vector2 pos1 = stepper.getInterpolatedPosition(particles[links[i].first]);
+        Vector2 pos2 = stepper.getInterpolatedPosition(particles[links[i].second]);
 
-            float distance = (pos2 - pos1).magnitude();
-
-            // Draw a line if blobs are within a certain distance threshold
-            if (distance < 80.0f)
-            {
-                glVertex2f(pos1.x, pos1.y);
-                glVertex2f(pos2.x, pos2.y);
-            }
-        }
+        glVertex2f(pos1.x, pos1.y);
+        glVertex2f(pos2.x, pos2.y);
     }
 
     glEnd(); // End drawing lines
@@ -323,53 +232,43 @@ void BlobDemo::drawBlobConnections()
 
 void BlobDemo::countBlobsInGrid()
 {
-    int topLeft = 0, topRight = 0, bottomLeft = 0, bottomRight = 0; // Initialize quadrant counters
-
-    // Iterate through all blobs to determine their quadrant
-    for (unsigned i = 0; i < BLOB_COUNT; i++)
-    {
-        Vector2 pos = blobs[i]->getPosition(); // Get blob position
-
-        // Categorize blob into the correct quadrant
-        if (pos.x < 0 && pos.y > 0) topLeft++;      // Upper-left quadrant
-        else if (pos.x > 0 && pos.y > 0) topRight++; // Upper-right quadrant
-        else if (pos.x < 0 && pos.y < 0) bottomLeft++; // Lower-left quadrant
-        else if (pos.x > 0 && pos.y < 0) bottomRight++; // Lower-right quadrant
-    }
+    // The world keeps the counts up to date as blobs cross the grid
+    const ParticleOccupancy& occupancy = world.getOccupancy();
 
     // Output the count of blobs in each quadrant
     std::cout << "Quadrant Counts: "
         << "(TL: TR: BL: BR: "
-        << topLeft << ", "
-        << topRight << ", "
-        << bottomLeft << ", "
-        << bottomRight << ")" << std::endl;
+        << occupancy.getRegionCount(0) << ", "
+        << occupancy.getRegionCount(1) << ", "
+        << occupancy.getRegionCount(2) << ", "
+        << occupancy.getRegionCount(3) << ", outside: "
+        << occupancy.getOutsideCount() << ")" << std::endl;
 }
 
 BlobDemo::~BlobDemo()
 {
-    // Delete all dynamically allocated blobs to free memory
-    for (unsigned i = 0; i < BLOB_COUNT; i++) {
-        delete blobs[i];
-    }
-
-    // Delete dynamically allocated platform array
-    delete[] platforms;
+    // The blobs are owned by the world and are released with it
 }
 
 
 void BlobDemo::update()
 {
-    float duration = timeinterval / 1000;  // Convert time interval from milliseconds to seconds
+    // Execute physics simulation, including blob collisions, in fixed
+    // steps covering the real time since the last update. The timer
+    // only sets how often the display is refreshed.
+    stepper.advance();
 
-    totalPhysicsTime += duration;  // Keep track of total simulation time
+    totalPhysicsTime = (float)stepper.getSimulatedTime();  // Keep track of total simulation time
 
-    // Display the running physics time in the console for debugging
-    std::cout << "Total Running Physics Time: " << totalPhysicsTime << " seconds" << std::endl;
+    // Report the running physics time and quadrant counts now and then,
+    // rather than writing to the console every frame
+    if (totalPhysicsTime - lastReportTime >= REPORT_INTERVAL)
+    {
+        lastReportTime = totalPhysicsTime;
+        std::cout << "Total Running Physics Time: " << totalPhysicsTime << " seconds" << std::endl;
+        countBlobsInGrid();       // Print the blob counts of each quadrant
+    }
 
-    world.runPhysics(duration);   // Execute physics simulation for all particles
-    handleBlobCollision();        // Detect and resolve collisions between blobs
-    countBlobsInGrid();           // Count blobs in each quadrant and print results
     Application::update();        // Call base class update function for additional processing
     glutPostRedisplay();          // Request a screen refresh to update visuals
 }
@@ -0,0 +1,270 @@
+/*
+ * Benchmarks for the physics library. Runs without a window, so it
+ * can be used on a build server.
+ */
+
+#include <pbroadphase.h>
+#include <pcollisions.h>
+#include <pworld.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+// Fills the store with the given number of particles scattered over a
+// square sized to keep the density constant, so the number of
+// overlapping pairs grows linearly with the count.
+static void scatterParticles(ParticleStore& store, unsigned count)
+{
+    const float radius = 3.0f;
+    const float spacing = 12.0f;   // Average distance between particles
+    float side = spacing * (float)std::sqrt((double)count);
+
+    srand(1);
+    store = ParticleStore();
+    store.reserve(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned index = store.add();
+        store.positionX[index] = side * rand() / (float)RAND_MAX;
+        store.positionY[index] = side * rand() / (float)RAND_MAX;
+        store.radius[index] = radius;
+        store.inverseMass[index] = 1.0f;
+    }
+}
+
+// The O(n^2) pair search the grid replaces, used as the baseline.
+static void bruteForcePairs(const ParticleStore& store, ParticlePairs& pairs)
+{
+    pairs.clear();
+    for (unsigned i = 0; i < store.size(); i++)
+    {
+        for (unsigned j = i + 1; j < store.size(); j++)
+        {
+            float dx = store.positionX[j] - store.positionX[i];
+            float dy = store.positionY[j] - store.positionY[i];
+            float r = store.radius[i] + store.radius[j];
+            if (dx*dx + dy*dy < r*r)
+            {
+                ParticlePair pair = { i, j };
+                pairs.push_back(pair);
+            }
+        }
+    }
+}
+
+// Returns the pairs as a sorted list with the lower index first, so
+// lists from different broadphases can be compared.
+static std::vector< std::pair<unsigned, unsigned> > sortedPairs(
+    const ParticlePairs& pairs)
+{
+    std::vector< std::pair<unsigned, unsigned> > sorted;
+    sorted.reserve(pairs.size());
+    for (unsigned i = 0; i < pairs.size(); i++)
+    {
+        sorted.push_back(std::make_pair(
+            std::min(pairs[i].first, pairs[i].second),
+            std::max(pairs[i].first, pairs[i].second)));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+// Returns true if the two lists hold the same pairs, in any order.
+static bool samePairs(const ParticlePairs& a, const ParticlePairs& b)
+{
+    return a.size() == b.size() && sortedPairs(a) == sortedPairs(b);
+}
+
+// Returns the time in microseconds taken by one call to run.
+template <typename Run>
+static double timeOnce(Run run)
+{
+    Clock::time_point start = Clock::now();
+    run();
+    Clock::time_point end = Clock::now();
+
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// Returns the average time in microseconds of one call to find.
+template <typename Find>
+static double timePairs(Find find, unsigned repetitions)
+{
+    find();   // Warm up caches and grow the buffers
+
+    double total = 0;
+    for (unsigned r = 0; r < repetitions; r++) total += timeOnce(find);
+    return total / repetitions;
+}
+
+static void benchBroadphase()
+{
+    static const unsigned counts[] = { 50, 500, 5000, 50000, 500000 };
+    const unsigned bruteForceLimit = 5000;
+
+    std::printf("Broadphase pair finding\n");
+    std::printf("%10s %10s %14s %14s\n",
+        "particles", "pairs", "grid (us)", "brute (us)");
+
+    ParticleStore store;
+    ParticleHashGrid grid;
+    ParticlePairs gridPairs, pairs;
+
+    for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        unsigned count = counts[c];
+        unsigned repetitions = count < 50000 ? 100 : 10;
+        scatterParticles(store, count);
+
+        double gridTime = timePairs(
+            [&]() { grid.findPairs(store, gridPairs); }, repetitions);
+
+        if (count <= bruteForceLimit)
+        {
+            double bruteTime = timePairs(
+                [&]() { bruteForcePairs(store, pairs); }, repetitions);
+            if (!samePairs(gridPairs, pairs))
+            {
+                std::printf("grid found %u pairs, brute force %u, "
+                    "not the same\n",
+                    (unsigned)gridPairs.size(), (unsigned)pairs.size());
+                std::exit(1);
+            }
+            std::printf("%10u %10u %14.1f %14.1f\n",
+                count, (unsigned)gridPairs.size(), gridTime, bruteTime);
+        }
+        else
+        {
+            std::printf("%10u %10u %14.1f %14s\n",
+                count, (unsigned)gridPairs.size(), gridTime, "-");
+        }
+    }
+}
+
+// Times the sweep-and-prune broadphase over a sequence of frames in
+// which every particle drifts a little, as in a settling scene.
+static void benchSweepAndPrune()
+{
+    static const unsigned counts[] = { 500, 5000, 50000, 500000 };
+    const unsigned frames = 20;
+    const float drift = 0.5f;   // Largest movement per frame
+
+    std::printf("\nSweep and prune over %u coherent frames\n", frames);
+    std::printf("%10s %10s %14s %14s %14s\n",
+        "particles", "pairs", "sap (us)", "grid (us)", "swaps/frame");
+
+    ParticleStore store;
+    ParticleSweepAndPrune sap;
+    ParticleHashGrid grid;
+    ParticlePairs sapPairs, pairs;
+
+    for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        unsigned count = counts[c];
+        scatterParticles(store, count);
+        sap.findPairs(store, sapPairs);   // The first call sorts from scratch
+
+        double sapTime = 0, gridTime = 0;
+        unsigned long long swaps = 0;
+        for (unsigned f = 0; f < frames; f++)
+        {
+            for (unsigned i = 0; i < count; i++)
+            {
+                store.positionX[i] += drift * (2.0f * rand() / RAND_MAX - 1.0f);
+                store.positionY[i] += drift * (2.0f * rand() / RAND_MAX - 1.0f);
+            }
+
+            sapTime += timeOnce([&]() { sap.findPairs(store, sapPairs); });
+            swaps += sap.getSwaps();
+
+            gridTime += timeOnce([&]() { grid.findPairs(store, pairs); });
+            if (!samePairs(sapPairs, pairs))
+            {
+                std::printf("sweep and prune found %u pairs, grid %u, "
+                    "not the same\n",
+                    (unsigned)sapPairs.size(), (unsigned)pairs.size());
+                std::exit(1);
+            }
+        }
+
+        std::printf("%10u %10u %14.1f %14.1f %14.1f\n",
+            count, (unsigned)pairs.size(), sapTime / frames, gridTime / frames,
+            (double)swaps / frames);
+    }
+}
+
+// Times the Verlet list against the hash grid on a packed pile of
+// particles jostling to rest, checking each frame that both find the
+// same pairs, and counts how often the list had to be rebuilt.
+static void benchVerletList()
+{
+    const unsigned count = 10000;
+    const unsigned columns = 100;
+    const float spacing = 2.05f;   // Leaves a little room between particles
+    const unsigned frames = 300;
+    const float skin = 0.5f;
+
+    std::printf("\nVerlet list over %u frames of a settling pile, skin %.2f\n",
+        frames, skin);
+    std::printf("%10s %10s %14s %14s %14s\n",
+        "particles", "pairs", "verlet (us)", "grid (us)", "rebuilds");
+
+    ParticleWorld world(count * 4, 20);
+    ParticleHashGrid worldGrid;
+    world.setBroadphase(&worldGrid);
+    ParticleCollisions collisions(&world, 0.3f);
+    world.getContactGenerators().push_back(&collisions);
+    world.getPositionCorrector().setEnabled(true);
+
+    srand(1);
+    for (unsigned i = 0; i < count; i++)
+    {
+        Particle *particle = world.createParticle();
+        particle->setPosition((i % columns) * spacing, (i / columns) * spacing);
+        particle->setVelocity(2.0f * rand() / RAND_MAX - 1.0f,
+                              2.0f * rand() / RAND_MAX - 1.0f);
+        particle->setRadius(1.0f + (i % 3) * 0.02f);
+        particle->setMass(1.0f);
+        particle->setDamping(0.5f);
+    }
+
+    ParticleVerletList verlet(skin);
+    ParticleHashGrid grid;
+    ParticlePairs verletPairs, pairs;
+
+    double verletTime = 0, gridTime = 0;
+    for (unsigned f = 0; f < frames; f++)
+    {
+        world.runPhysics(0.01f);
+        const ParticleStore& store = world.getStore();
+
+        verletTime += timeOnce([&]() { verlet.findPairs(store, verletPairs); });
+        gridTime += timeOnce([&]() { grid.findPairs(store, pairs); });
+        if (!samePairs(verletPairs, pairs))
+        {
+            std::printf("Verlet list found %u pairs, grid %u, "
+                "not the same at frame %u\n",
+                (unsigned)verletPairs.size(), (unsigned)pairs.size(), f);
+            std::exit(1);
+        }
+    }
+
+    std::printf("%10u %10u %14.1f %14.1f %14u\n",
+        count, (unsigned)pairs.size(), verletTime / frames, gridTime / frames,
+        verlet.getRebuildCount());
+}
+
+int main()
+{
+    benchBroadphase();
+    benchSweepAndPrune();
+    benchVerletList();
+    return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Headless driver for the blob scene. Builds the BlobDemo layout at
+ * any size, steps it as fast as possible and reports where the time
+ * goes, so the physics can be measured without a window.
+ */
+
+#include <pworld.h>
+#include <pcollisions.h>
+#include <platform.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+// The library leaves gravity to the application.
+const Vector2 Vector2::GRAVITY = Vector2(0, -9.81);
+
+typedef std::chrono::steady_clock Clock;
+
+// The demo scene is one tile: a 200 x 200 arena with its platforms
+// and this many blobs. Bigger scenes are a square of tiles.
+static const unsigned BLOBS_PER_TILE = 50;
+static const unsigned PLATFORMS_PER_TILE = 15;
+static const float TILE_SIZE = 200.0f;
+
+struct Options
+{
+    unsigned blobs;
+    unsigned frames;
+    unsigned threads;
+    const char *broadphase;
+    const char *resolver;
+    float warmStart;
+    float reuse;
+    float correct;
+    float sleep;
+    float restitution;
+    float sweep;
+    unsigned substeps;
+    unsigned occupancy;
+    float skin;
+};
+
+static void usage(const char *name)
+{
+    std::printf(
+        "usage: %s [options]\n"
+        "  --blobs N          number of blobs, up to 1000000 (default 5000)\n"
+        "  --frames N         frames to step (default 200)\n"
+        "  --threads N        threads, 0 for one per core (default 1)\n"
+        "  --broadphase NAME  grid, sap or verlet (default grid)\n"
+        "  --skin D           skin distance of the verlet lists (default 1)\n"
+        "  --resolver NAME    scan, heap or colored (default heap)\n"
+        "  --warm F           warm start with this fraction of last frame's\n"
+        "                     impulses, 0 for off (default 0)\n"
+        "  --reuse D          with --warm, reuse contacts that moved less\n"
+        "                     than D (default 0)\n"
+        "  --correct F        push overlapping particles apart by this\n"
+        "                     fraction of their penetration, 0 for off\n"
+        "                     (default 0)\n"
+        "  --sleep V          put islands resting below speed V to sleep,\n"
+        "                     0 for off (default 0)\n"
+        "  --restitution E    restitution of every contact (default 1)\n"
+        "  --sweep F          sweep particles moving more than F times their\n"
+        "                     radius a step against the platforms, 0 for\n"
+        "                     off (default 0)\n"
+        "  --substeps N       split violent frames into up to N substeps\n"
+        "                     (default 1)\n"
+        "  --occupancy N      count the blobs in an N by N grid over the\n"
+        "                     level, 0 for off (default 0)\n",
+        name);
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+    options.blobs = 5000;
+    options.frames = 200;
+    options.threads = 1;
+    options.broadphase = "grid";
+    options.resolver = "heap";
+    options.warmStart = 0;
+    options.reuse = 0;
+    options.correct = 0;
+    options.sleep = 0;
+    options.restitution = 1;
+    options.sweep = 0;
+    options.substeps = 1;
+    options.occupancy = 0;
+    options.skin = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) return false;
+
+        if (std::strcmp(argv[i], "--blobs") == 0) options.blobs = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--frames") == 0) options.frames = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--threads") == 0) options.threads = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--broadphase") == 0) options.broadphase = value;
+        else if (std::strcmp(argv[i], "--resolver") == 0) options.resolver = value;
+        else if (std::strcmp(argv[i], "--warm") == 0) options.warmStart = (float)std::atof(value);
+        else if (std::strcmp(argv[i], "--reuse") == 0) options.reuse = (float)std::atof(value);
+        else if (std::strcmp(argv[i], "--correct") == 0) options.correct = (float)std::atof(value);
+        else if (std::strcmp(argv[i], "--sleep") == 0) options.sleep = (float)std::atof(value);
+        else if (std::strcmp(argv[i], "--restitution") == 0) options.restitution = (float)std::atof(value);
+        else if (std::strcmp(argv[i], "--sweep") == 0) options.sweep = (float)std::atof(value);
+        else if (std::strcmp(argv[i], "--substeps") == 0) options.substeps = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--occupancy") == 0) options.occupancy = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--skin") == 0) options.skin = (float)std::atof(value);
+        else return false;
+        i++;
+    }
+
+    if (options.blobs < 1 || options.blobs > 1000000) return false;
+    if (options.frames < 1) return false;
+    if (options.substeps < 1) return false;
+    if (std::strcmp(options.broadphase, "grid") != 0 &&
+        std::strcmp(options.broadphase, "sap") != 0 &&
+        std::strcmp(options.broadphase, "verlet") != 0) return false;
+    if (std::strcmp(options.resolver, "scan") != 0 &&
+        std::strcmp(options.resolver, "heap") != 0 &&
+        std::strcmp(options.resolver, "colored") != 0) return false;
+    return true;
+}
+
+// Adds the demo's platforms, offset to the given tile centre.
+static void addTilePlatforms(PlatformContacts &platforms, const Vector2 &centre)
+{
+    const float range = TILE_SIZE * 0.5f * 0.95f;
+
+    static const float layout[PLATFORMS_PER_TILE][4] = {
+        // Vertical platforms
+        { 0, 0, 0, -50 },
+        { -1, -1, -1, 1 },
+        { 1, -1, 1, 1 },
+        // Horizontal platforms
+        { -1, -1, 1, -1 },
+        { -1, 1, 1, 1 },
+        // Diagonals meeting at the centre
+        { -50, 50, 0, 0 },
+        { 50, 50, 0, 0 },
+        { -50, -50, 0, 0 },
+        { 50, -50, 0, 0 },
+        // Vertical and horizontal platforms in the middle
+        { -30, -1, -30, 1 },
+        { 30, -1, 30, 1 },
+        { -1, -30, 1, -30 },
+        { -1, 30, 1, 30 },
+        // Full diagonals
+        { -1, -1, 1, 1 },
+        { -1, 1, 1, -1 },
+    };
+
+    // Coordinates of +-1 are the arena edge; anything else is a fixed
+    // offset from the centre.
+    for (unsigned p = 0; p < PLATFORMS_PER_TILE; p++)
+    {
+        float c[4];
+        for (unsigned k = 0; k < 4; k++)
+        {
+            float v = layout[p][k];
+            c[k] = (v == 1 || v == -1) ? v * range : v;
+        }
+        platforms.addPlatform(centre + Vector2(c[0], c[1]),
+                              centre + Vector2(c[2], c[3]));
+    }
+}
+
+// Adds one of the demo's blobs, offset to the given tile centre.
+static void addTileBlob(ParticleWorld &world, const Vector2 &centre, unsigned i)
+{
+    Particle *blob = world.createParticle();
+    blob->setPosition(centre.x - 60.0f + (i % 5) * 40.0f,
+                      centre.y + 90.0f - (i / 5) * 30.0f);
+    blob->setRadius(3);
+    blob->setVelocity(100.0, 200.0);
+    blob->setDamping(0.9f);
+    blob->setAcceleration(Vector2::GRAVITY * 5.0f * (float)((i % 5) + 1));
+    blob->setMass(100.0f);
+    blob->clearAccumulator();
+}
+
+static double elapsed(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    unsigned tiles = (options.blobs + BLOBS_PER_TILE - 1) / BLOBS_PER_TILE;
+    unsigned side = (unsigned)std::ceil(std::sqrt((double)tiles));
+    unsigned platformCount = tiles * PLATFORMS_PER_TILE;
+
+    // Build the scene, sized for contacts the way the demo is.
+    ParticleWorld world(platformCount + options.blobs * 2);
+    world.setThreadCount(options.threads);
+
+    ParticleHashGrid grid;
+    ParticleSweepAndPrune sap;
+    ParticleVerletList verlet(options.skin);
+    if (std::strcmp(options.broadphase, "sap") == 0) world.setBroadphase(&sap);
+    else if (std::strcmp(options.broadphase, "verlet") == 0) world.setBroadphase(&verlet);
+    else world.setBroadphase(&grid);
+
+    ThreadPool serialPool(1);
+    ThreadPool *pool = world.getThreadPool() ? world.getThreadPool() : &serialPool;
+    ParticleColoredResolver coloredResolver(pool, 100);
+    if (std::strcmp(options.resolver, "colored") == 0)
+    {
+        world.setColoredResolver(&coloredResolver);
+    }
+    else if (std::strcmp(options.resolver, "heap") == 0)
+    {
+        world.getResolver().setMode(ParticleContactResolver::MODE_HEAP);
+    }
+
+    if (options.warmStart > 0)
+    {
+        ParticleContactCache &cache = world.getContactCache();
+        cache.setEnabled(true);
+        cache.setWarmStartFactor(options.warmStart);
+        cache.setMotionThreshold(options.reuse);
+    }
+
+    if (options.correct > 0)
+    {
+        ParticlePositionCorrector &corrector = world.getPositionCorrector();
+        corrector.setEnabled(true);
+        corrector.setFactor(options.correct);
+    }
+
+    if (options.sleep > 0)
+    {
+        ParticleSleep &sleep = world.getSleep();
+        sleep.setEnabled(true);
+        sleep.setVelocityThreshold(options.sleep);
+    }
+
+    world.setMaxSubsteps(options.substeps);
+
+    if (options.occupancy > 0)
+    {
+        // The grid covers the tiles, and a region each quarter of it.
+        unsigned cells = options.occupancy;
+        Vector2 corner(-0.5f * TILE_SIZE, -0.5f * TILE_SIZE);
+        ParticleOccupancy &occupancy = world.getOccupancy();
+        occupancy.setEnabled(true);
+        occupancy.setGrid(corner, corner + Vector2(side * TILE_SIZE, side * TILE_SIZE),
+                          cells, cells);
+        unsigned half = cells / 2;
+        for (unsigned q = 0; q < 4; q++)
+        {
+            occupancy.addRegion(q % 2 ? half : 0, q / 2 ? half : 0,
+                                q % 2 ? cells - half : half,
+                                q / 2 ? cells - half : half);
+        }
+    }
+
+    PlatformContacts platforms(&world, options.restitution);
+    ParticleCollisions collisions(&world, options.restitution);
+
+    world.reserveParticles(options.blobs);
+    for (unsigned t = 0; t < tiles; t++)
+    {
+        Vector2 centre((t % side) * TILE_SIZE, (t / side) * TILE_SIZE);
+        addTilePlatforms(platforms, centre);
+
+        for (unsigned i = 0; i < BLOBS_PER_TILE; i++)
+        {
+            if (t * BLOBS_PER_TILE + i == options.blobs) break;
+            addTileBlob(world, centre, i);
+        }
+    }
+    platforms.build();
+    world.getContactGenerators().push_back(&platforms);
+    if (options.sweep > 0)
+    {
+        world.getObstacles().push_back(&platforms);
+        world.setSweepThreshold(options.sweep);
+    }
+    world.getContactGenerators().push_back(&collisions);
+
+    std::printf("blobs %u, platforms %u, frames %u, threads %u, "
+        "broadphase %s, resolver %s\n",
+        options.blobs, platformCount, options.frames, world.getThreadCount(),
+        options.broadphase, options.resolver);
+
+    // Step the world, adding up what each step cost.
+    const float duration = 0.01f;
+    double integrateTime = 0, broadphaseTime = 0;
+    double narrowphaseTime = 0, resolveTime = 0, correctTime = 0, sleepTime = 0;
+    double occupancyTime = 0;
+    double generatorTime[2] = { 0, 0 };
+    unsigned long long totalContacts = 0, totalDropped = 0;
+    unsigned long long totalPairs = 0, totalIterations = 0;
+    unsigned long long totalReused = 0, totalAsleep = 0;
+    unsigned long long totalSwept = 0, totalStopped = 0, totalSubsteps = 0;
+
+    Clock::time_point start = Clock::now();
+    for (unsigned f = 0; f < options.frames; f++)
+    {
+        totalSubsteps += world.runPhysics(duration);
+
+        const ParticleStepStats &stats = world.getStepStats();
+        integrateTime += stats.integrateTime * 1000.0;
+        broadphaseTime += stats.broadphaseTime * 1000.0;
+        narrowphaseTime += stats.generateTime * 1000.0;
+        resolveTime += stats.resolveTime * 1000.0;
+        correctTime += stats.correctTime * 1000.0;
+        sleepTime += stats.sleepTime * 1000.0;
+        occupancyTime += stats.occupancyTime * 1000.0;
+        for (unsigned g = 0; g < stats.generatorTime.size(); g++)
+        {
+            generatorTime[g] += stats.generatorTime[g] * 1000.0;
+        }
+        totalContacts += stats.contactsGenerated;
+        totalDropped += stats.contactsDropped;
+        totalIterations += stats.iterationsUsed;
+        totalReused += stats.contactsReused;
+        totalAsleep += stats.particlesAsleep;
+        totalSwept += stats.particlesSwept;
+        totalStopped += stats.particlesStopped;
+        totalPairs += world.getPairs().size();
+    }
+    double totalTime = elapsed(start, Clock::now());
+
+    double frames = options.frames;
+    std::printf("%-14s %12s %8s\n", "phase", "ms/frame", "share");
+    std::printf("%-14s %12.3f %7.1f%%\n", "integrate",
+        integrateTime / frames, 100.0 * integrateTime / totalTime);
+    std::printf("%-14s %12.3f %7.1f%%\n", "broadphase",
+        broadphaseTime / frames, 100.0 * broadphaseTime / totalTime);
+    std::printf("%-14s %12.3f %7.1f%%\n", "narrowphase",
+        narrowphaseTime / frames, 100.0 * narrowphaseTime / totalTime);
+    std::printf("%-14s %12.3f\n", "  platforms", generatorTime[0] / frames);
+    std::printf("%-14s %12.3f\n", "  collisions", generatorTime[1] / frames);
+    std::printf("%-14s %12.3f %7.1f%%\n", "resolve",
+        resolveTime / frames, 100.0 * resolveTime / totalTime);
+    std::printf("%-14s %12.3f %7.1f%%\n", "correct",
+        correctTime / frames, 100.0 * correctTime / totalTime);
+    std::printf("%-14s %12.3f %7.1f%%\n", "sleep",
+        sleepTime / frames, 100.0 * sleepTime / totalTime);
+    std::printf("%-14s %12.3f %7.1f%%\n", "occupancy",
+        occupancyTime / frames, 100.0 * occupancyTime / totalTime);
+    std::printf("%-14s %12.3f\n", "total", totalTime / frames);
+    std::printf("pairs/frame %.1f, contacts/frame %.1f, dropped/frame %.1f\n",
+        totalPairs / frames, totalContacts / frames, totalDropped / frames);
+    std::printf("iterations/frame %.1f, reused/frame %.1f, asleep/frame %.1f\n",
+        totalIterations / frames, totalReused / frames, totalAsleep / frames);
+    std::printf("swept/frame %.1f, stopped/frame %.1f, substeps/frame %.2f\n",
+        totalSwept / frames, totalStopped / frames, totalSubsteps / frames);
+    if (options.occupancy > 0)
+    {
+        const ParticleOccupancy &occupancy = world.getOccupancy();
+        std::printf("quarters %u %u %u %u, outside %u\n",
+            occupancy.getRegionCount(0), occupancy.getRegionCount(1),
+            occupancy.getRegionCount(2), occupancy.getRegionCount(3),
+            occupancy.getOutsideCount());
+    }
+    if (std::strcmp(options.broadphase, "verlet") == 0)
+    {
+        std::printf("verlet rebuilds %u, neighbours %u\n",
+            verlet.getRebuildCount(), verlet.getNeighbourCount());
+    }
+    std::printf("steps/s %.1f\n", 1000.0 * options.frames / totalTime);
+
+    return 0;
+}
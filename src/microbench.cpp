@@ -0,0 +1,493 @@
+/*
+ * Microbenchmarks for the hot kernels of the physics library: the
+ * Vector2 operators, particle integration, platform contacts and
+ * contact resolution. Each is timed at several sizes and reported as
+ * nanoseconds per item, with the median and 99th percentile over
+ * many repetitions. The results can also be written as JSON so they
+ * can be compared between builds.
+ */
+
+#include <pworld.h>
+#include <platform.h>
+#include <pbatch.h>
+#include <coreSimd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+// Keeps the compiler from discarding results that are never used.
+static volatile float sink;
+
+struct Options
+{
+    unsigned repetitions;
+    unsigned warmup;
+    const char *filter;
+    const char *json;
+};
+
+struct Result
+{
+    std::string name;
+    unsigned size;
+    unsigned repetitions;
+    double median;
+    double p99;
+    double min;
+    double mean;
+};
+
+static Options options;
+static std::vector<Result> results;
+
+// Each sample runs the body enough times to last at least this long,
+// so small sizes are not lost in the clock's resolution.
+static const double MIN_SAMPLE_NS = 50000.0;
+
+static double timeRuns(const std::function<void()> &body, unsigned runs)
+{
+    Clock::time_point start = Clock::now();
+    for (unsigned r = 0; r < runs; r++) body();
+    Clock::time_point end = Clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// Times body, which processes size items per call, and records the
+// time per item.
+static void measure(const char *name, unsigned size,
+                    const std::function<void()> &body)
+{
+    if (options.filter && !std::strstr(name, options.filter)) return;
+
+    // Warm up caches and branch predictors, and find how many calls
+    // make a sample long enough to time.
+    double warmupTime = 0;
+    for (unsigned w = 0; w < options.warmup; w++) warmupTime += timeRuns(body, 1);
+    double callTime = warmupTime / (options.warmup ? options.warmup : 1);
+    unsigned runs = callTime >= MIN_SAMPLE_NS ? 1 :
+        (unsigned)std::ceil(MIN_SAMPLE_NS / std::max(callTime, 1.0));
+
+    std::vector<double> samples(options.repetitions);
+    for (unsigned r = 0; r < options.repetitions; r++)
+    {
+        samples[r] = timeRuns(body, runs) / ((double)runs * size);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = name;
+    result.size = size;
+    result.repetitions = options.repetitions;
+    result.median = samples[samples.size() / 2];
+    result.p99 = samples[(samples.size() * 99 + 99) / 100 - 1];
+    result.min = samples[0];
+    result.mean = 0;
+    for (unsigned r = 0; r < samples.size(); r++) result.mean += samples[r];
+    result.mean /= samples.size();
+    results.push_back(result);
+
+    std::printf("%-36s %8u %10.2f %10.2f %10.2f\n",
+        name, size, result.median, result.p99, result.min);
+}
+
+// Returns a pseudo-random number in [-1, 1], repeatable between runs.
+static float randomUnit()
+{
+    return 2.0f * rand() / (float)RAND_MAX - 1.0f;
+}
+
+static void benchVector(unsigned size)
+{
+    std::vector<Vector2> a(size), b(size), out(size);
+    srand(1);
+    for (unsigned i = 0; i < size; i++)
+    {
+        a[i] = Vector2(randomUnit() * 100.0f, randomUnit() * 100.0f);
+        b[i] = Vector2(randomUnit(), randomUnit());
+    }
+
+    measure("Vector2::unit", size, [&]() {
+        for (unsigned i = 0; i < size; i++) out[i] = a[i].unit();
+        sink = out[size - 1].x;
+    });
+
+    measure("Vector2::magnitude", size, [&]() {
+        float total = 0;
+        for (unsigned i = 0; i < size; i++) total += a[i].magnitude();
+        sink = total;
+    });
+
+    // Alternate the sign so the values stay bounded however many
+    // times the body runs.
+    float scale = 0.5f;
+    measure("Vector2::addScaledVector", size, [&]() {
+        for (unsigned i = 0; i < size; i++) out[i].addScaledVector(b[i], scale);
+        scale = -scale;
+        sink = out[size - 1].x;
+    });
+}
+
+// Times the packed vector types on the same data as benchVector, a
+// lane's worth of vectors at a time, read from and written to
+// separate arrays of x and y values.
+template <class Lanes>
+static void benchLanes(unsigned size, const char *unitName,
+                       const char *fastUnitName, const char *magnitudeName,
+                       const char *addScaledName)
+{
+    const unsigned width = Lanes::WIDTH;
+    std::vector<float> ax(size), ay(size), bx(size), by(size);
+    std::vector<float> outX(size), outY(size);
+    srand(1);
+    for (unsigned i = 0; i < size; i++)
+    {
+        ax[i] = randomUnit() * 100.0f;
+        ay[i] = randomUnit() * 100.0f;
+        bx[i] = randomUnit();
+        by[i] = randomUnit();
+    }
+
+    measure(unitName, size, [&]() {
+        for (unsigned i = 0; i < size; i += width)
+        {
+            Lanes::load(&ax[i], &ay[i]).unit().store(&outX[i], &outY[i]);
+        }
+        sink = outX[size - 1];
+    });
+
+    measure(fastUnitName, size, [&]() {
+        for (unsigned i = 0; i < size; i += width)
+        {
+            Lanes::load(&ax[i], &ay[i]).fastUnit().store(&outX[i], &outY[i]);
+        }
+        sink = outX[size - 1];
+    });
+
+    measure(magnitudeName, size, [&]() {
+        typename Lanes::Floats total;
+        for (unsigned i = 0; i < size; i += width)
+        {
+            total += Lanes::load(&ax[i], &ay[i]).magnitude();
+        }
+        for (unsigned lane = 0; lane < width; lane++) sink = total[lane];
+    });
+
+    // Alternate the sign so the values stay bounded however many
+    // times the body runs.
+    float scale = 0.5f;
+    measure(addScaledName, size, [&]() {
+        for (unsigned i = 0; i < size; i += width)
+        {
+            Lanes out = Lanes::load(&outX[i], &outY[i]);
+            out.addScaledVector(Lanes::load(&bx[i], &by[i]),
+                                typename Lanes::Floats(scale));
+            out.store(&outX[i], &outY[i]);
+        }
+        scale = -scale;
+        sink = outX[size - 1];
+    });
+}
+
+// Fills the world with particles scattered over a square of the given
+// side.
+static void scatterParticles(ParticleWorld &world, unsigned count, float side)
+{
+    srand(2);
+    world.reserveParticles(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        Particle *particle = world.createParticle();
+        particle->setPosition(randomUnit() * side, randomUnit() * side);
+        particle->setVelocity(randomUnit() * 10.0f, randomUnit() * 10.0f);
+        particle->setAcceleration(Vector2(0, -9.81f));
+        particle->setDamping(0.9f);
+        particle->setRadius(3);
+        particle->setMass(1.0f);
+    }
+}
+
+static void benchParticle(unsigned size)
+{
+    ParticleWorld world(1);
+    scatterParticles(world, size, 100.0f);
+    ParticleWorld::Particles &particles = world.getParticles();
+
+    measure("Particle::integrate", size, [&]() {
+        for (unsigned i = 0; i < size; i++) particles[i]->integrate(0.001f);
+    });
+}
+
+static void benchPlatform(unsigned size)
+{
+    // The platform crosses the square, so some particles touch it.
+    ParticleWorld world(size);
+    scatterParticles(world, size, 100.0f);
+    std::vector<ParticleContact> contacts(size);
+
+    Platform platform(&world);
+    platform.start = Vector2(-100.0f, -10.0f);
+    platform.end = Vector2(100.0f, 10.0f);
+
+    measure("Platform::addContact", size, [&]() {
+        sink = (float)platform.addContact(&contacts[0], size);
+    });
+
+    // A level's worth of platforms across the square, called one by
+    // one through the virtual interface and then as a set.
+    const unsigned count = 15;
+    std::vector<Platform> platforms(count, Platform(&world));
+    ParticleGeneratorSet<Platform> set(&world);
+    for (unsigned p = 0; p < count; p++)
+    {
+        float y = -100.0f + 200.0f * (p + 0.5f) / count;
+        platforms[p].start = Vector2(-100.0f, y);
+        platforms[p].end = Vector2(100.0f, y);
+        set.getGenerators().push_back(platforms[p]);
+    }
+    std::vector<const ParticleContactGenerator*> generators(count);
+    for (unsigned p = 0; p < count; p++) generators[p] = &platforms[p];
+    contacts.resize(size * 2);
+
+    measure("Platform x15 (virtual)", size, [&]() {
+        unsigned used = 0;
+        for (unsigned p = 0; p < count; p++)
+        {
+            used += generators[p]->addContact(&contacts[used],
+                                              (unsigned)contacts.size() - used);
+        }
+        sink = (float)used;
+    });
+    measure("ParticleGeneratorSet<Platform> x15", size, [&]() {
+        sink = (float)set.addContact(&contacts[0], (unsigned)contacts.size());
+    });
+}
+
+static void benchNeighbours(unsigned size)
+{
+    // As dense as the blob demo, with links out to 80 units.
+    ParticleWorld world(size);
+    scatterParticles(world, size, 100.0f * std::sqrt(size / 50.0f));
+    const ParticleStore &store = world.getStore();
+    const float distance = 80.0f;
+
+    ParticleHashGrid grid;
+    ParticlePairs pairs;
+    measure("ParticleHashGrid::findPairsWithin", size, [&]() {
+        grid.build(store, distance);
+        grid.findPairsWithin(store, distance, pairs);
+        sink = (float)pairs.size();
+    });
+
+    if (size > 1024) return;
+    measure("pairs within distance (every pair)", size, [&]() {
+        pairs.clear();
+        for (unsigned i = 0; i + 1 < size; i++)
+        {
+            for (unsigned j = i + 1; j < size; j++)
+            {
+                float dx = store.positionX[j] - store.positionX[i];
+                float dy = store.positionY[j] - store.positionY[i];
+                if (dx*dx + dy*dy < distance * distance)
+                {
+                    ParticlePair pair = { i, j };
+                    pairs.push_back(pair);
+                }
+            }
+        }
+        sink = (float)pairs.size();
+    });
+}
+
+// Fills the store with a row of touching particles, each moving
+// towards its neighbours, and the contacts between them.
+static void buildChain(ParticleWorld &world, unsigned size,
+                       std::vector<ParticleContact> &contacts)
+{
+    world.reserveParticles(size + 1);
+    for (unsigned i = 0; i <= size; i++)
+    {
+        Particle *particle = world.createParticle();
+        particle->setPosition(i * 6.0f, 0);
+        particle->setVelocity(i % 2 ? -1.0f - i % 7 : 1.0f + i % 5, 0);
+        particle->setRadius(3);
+        particle->setMass(1.0f + i % 3);
+    }
+
+    ParticleWorld::Particles &particles = world.getParticles();
+    contacts.resize(size);
+    for (unsigned i = 0; i < size; i++)
+    {
+        contacts[i].particle[0] = particles[i];
+        contacts[i].particle[1] = particles[i + 1];
+        contacts[i].contactNormal = Vector2(-1, 0);
+        contacts[i].restitution = 1.0f;
+        contacts[i].penetration = 0;
+    }
+}
+
+static void benchResolveVelocity(unsigned size)
+{
+    ParticleWorld world(1);
+    std::vector<ParticleContact> contacts;
+    buildChain(world, size, contacts);
+
+    // A contact only needs an impulse while it is closing, so keep a
+    // copy with the normals flipped and alternate between the two.
+    std::vector<ParticleContact> flipped(contacts);
+    for (unsigned i = 0; i < size; i++) flipped[i].contactNormal.invert();
+
+    // resolveVelocity is private; a resolver with one iteration over
+    // a single contact calls it exactly once.
+    ParticleContactResolver resolver(1);
+    bool flip = false;
+    measure("ParticleContact::resolveVelocity", size, [&]() {
+        ParticleContact *batch = flip ? &flipped[0] : &contacts[0];
+        for (unsigned i = 0; i < size; i++) resolver.resolveContacts(batch + i, 1, 0.001f);
+        flip = !flip;
+    });
+}
+
+static void benchResolver(unsigned size, ParticleContactResolver::Mode mode,
+                          const char *name)
+{
+    ParticleWorld world(1);
+    std::vector<ParticleContact> contacts;
+    buildChain(world, size, contacts);
+
+    // Each run starts from the same velocities; restoring them is
+    // linear, and small next to the resolver.
+    ParticleStore &store = world.getStore();
+    std::vector<float> velocityX = store.velocityX;
+
+    ParticleContactResolver resolver(size * 2, mode);
+    measure(name, size, [&]() {
+        store.velocityX = velocityX;
+        resolver.resolveContacts(&contacts[0], size, 0.001f);
+    });
+}
+
+static void writeJson(const char *path)
+{
+    FILE *file = std::fopen(path, "w");
+    if (!file)
+    {
+        std::fprintf(stderr, "cannot write %s\n", path);
+        std::exit(1);
+    }
+
+    std::fprintf(file, "{\n  \"unit\": \"ns/item\",\n  \"benchmarks\": [\n");
+    for (unsigned r = 0; r < results.size(); r++)
+    {
+        const Result &result = results[r];
+        std::fprintf(file,
+            "    { \"name\": \"%s\", \"size\": %u, \"repetitions\": %u, "
+            "\"median\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"mean\": %.4f }%s\n",
+            result.name.c_str(), result.size, result.repetitions,
+            result.median, result.p99, result.min, result.mean,
+            r + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+}
+
+static void usage(const char *name)
+{
+    std::printf(
+        "usage: %s [options]\n"
+        "  --repetitions N  timed samples per benchmark (default 101)\n"
+        "  --warmup N       untimed runs before sampling (default 5)\n"
+        "  --filter TEXT    only run benchmarks whose name contains TEXT\n"
+        "  --json PATH      also write the results to PATH as JSON\n",
+        name);
+}
+
+static bool parseOptions(int argc, char **argv)
+{
+    options.repetitions = 101;
+    options.warmup = 5;
+    options.filter = NULL;
+    options.json = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) return false;
+
+        if (std::strcmp(argv[i], "--repetitions") == 0) options.repetitions = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--warmup") == 0) options.warmup = (unsigned)std::atoi(value);
+        else if (std::strcmp(argv[i], "--filter") == 0) options.filter = value;
+        else if (std::strcmp(argv[i], "--json") == 0) options.json = value;
+        else return false;
+        i++;
+    }
+
+    return options.repetitions > 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parseOptions(argc, argv))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static const unsigned sizes[] = { 64, 4096, 262144 };
+    static const unsigned resolverSizes[] = { 64, 1024, 16384 };
+    const unsigned scanLimit = 1024;   // The scan is quadratic
+
+    std::printf("%-36s %8s %10s %10s %10s\n",
+        "benchmark (ns/item)", "size", "median", "p99", "min");
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        benchVector(sizes[s]);
+    }
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        benchLanes<Vector2x4>(sizes[s], "Vector2x4::unit", "Vector2x4::fastUnit",
+            "Vector2x4::magnitude", "Vector2x4::addScaledVector");
+        benchLanes<Vector2x8>(sizes[s], "Vector2x8::unit", "Vector2x8::fastUnit",
+            "Vector2x8::magnitude", "Vector2x8::addScaledVector");
+    }
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        benchParticle(sizes[s]);
+    }
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        benchPlatform(sizes[s]);
+    }
+    for (unsigned s = 0; s < sizeof(resolverSizes) / sizeof(resolverSizes[0]); s++)
+    {
+        benchNeighbours(resolverSizes[s]);
+    }
+    for (unsigned s = 0; s < sizeof(resolverSizes) / sizeof(resolverSizes[0]); s++)
+    {
+        benchResolveVelocity(resolverSizes[s]);
+    }
+    for (unsigned s = 0; s < sizeof(resolverSizes) / sizeof(resolverSizes[0]); s++)
+    {
+        unsigned size = resolverSizes[s];
+        if (size <= scanLimit)
+        {
+            benchResolver(size, ParticleContactResolver::MODE_SCAN,
+                "ParticleContactResolver (scan)");
+        }
+        benchResolver(size, ParticleContactResolver::MODE_HEAP,
+            "ParticleContactResolver (heap)");
+    }
+
+    if (options.json) writeJson(options.json);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <assert.h>
+#include <algorithm>
+#include <parena.h>
+
+
+ParticleContactArena::ParticleContactArena(unsigned capacity)
+:
+contacts(capacity + 1),
+limit(0),
+policy(OVERFLOW_DROP),
+overflows(0)
+{
+}
+
+ParticleContact* ParticleContactArena::getContacts()
+{
+    return contacts.data();
+}
+
+unsigned ParticleContactArena::getCapacity() const
+{
+    return (unsigned)contacts.size() - 1;
+}
+
+void ParticleContactArena::setLimit(unsigned limit, OverflowPolicy policy)
+{
+    ParticleContactArena::limit = limit;
+    ParticleContactArena::policy = policy;
+    if (limit && getCapacity() > limit) contacts.resize(limit + 1);
+}
+
+unsigned ParticleContactArena::getLimit() const
+{
+    return limit;
+}
+
+unsigned ParticleContactArena::getOverflowCount() const
+{
+    return overflows;
+}
+
+unsigned ParticleContactArena::reserve(unsigned count)
+{
+    unsigned capacity = getCapacity();
+    if (count <= capacity) return capacity;
+
+    // Grow geometrically, so a frame that needs more room only pays
+    // for a logarithmic number of reallocations.
+    if (capacity < 64) capacity = 64;
+    while (capacity < count) capacity *= 2;
+    if (limit && capacity > limit) capacity = limit;
+
+    contacts.resize(capacity + 1);
+    return capacity;
+}
+
+unsigned ParticleContactArena::generate(const ParticleContactGenerator *generator,
+                                        unsigned offset)
+{
+    for (;;)
+    {
+        // Let the generator write into the spare slot past its room,
+        // so one that does is known to have had more.
+        unsigned room = getCapacity() - offset;
+        unsigned used = generator->addContact(&contacts[offset], room + 1);
+        if (used <= room) return used;
+
+        if (limit && getCapacity() >= limit)
+        {
+            recordOverflow();
+            return room;
+        }
+        reserve(getCapacity() + 1);
+    }
+}
+
+unsigned ParticleContactArena::append(const ParticleContact *source,
+                                      unsigned count, unsigned offset)
+{
+    unsigned room = reserve(offset + count) - offset;
+    if (count > room)
+    {
+        recordOverflow();
+        count = room;
+    }
+
+    std::copy(source, source + count, contacts.begin() + offset);
+    return count;
+}
+
+void ParticleContactArena::recordOverflow()
+{
+    overflows++;
+    assert(policy != OVERFLOW_ASSERT && "contact arena overflowed its limit");
+}
@@ -1,43 +1,37 @@
-
 #include "particle.h"
 #include <math.h>
 #include <assert.h>
 #include <float.h>
 
 
-void Particle::integrate(float duration)
+Particle::Particle(ParticleStore *store, unsigned index)
+:
+store(store),
+index(index)
 {
+}
 
-	// We don't integrate things with zero mass.
-   if (inverseMass <= 0.0f) return;
-
-	assert(duration > 0.0);
-	position.addScaledVector(velocity, duration);
-
-	// Work out the acceleration from the force
-    Vector2 resultingAcc = acceleration;
-   resultingAcc.addScaledVector(forceAccum, inverseMass);
-
-	// Update linear velocity from the acceleration.
-    velocity.addScaledVector(resultingAcc, duration);
-
-	// Impose drag.
-	velocity *= pow(damping, duration);
+unsigned Particle::getIndex() const
+{
+    return index;
+}
 
-	// Clear the forces.
-    clearAccumulator();
+void Particle::integrate(float duration)
+{
+    store->integrate(index, duration);
 }
 
 void Particle::setMass(const float mass)
 {
     assert(mass != 0);
-    Particle::inverseMass = ((float)1.0)/mass;
+    store->inverseMass[index] = ((float)1.0)/mass;
 }
 
 float Particle::getMass() const
 {
+    float inverseMass = store->inverseMass[index];
     if (inverseMass == 0) {
-        return DBL_MAX;
+        return FLT_MAX;
     } else {
         return ((float)1.0)/inverseMass;
     }
@@ -45,109 +39,115 @@ float Particle::getMass() const
 
 void Particle::setInverseMass(const float inverseMass)
 {
-    Particle::inverseMass = inverseMass;
+    store->inverseMass[index] = inverseMass;
 }
 
 float Particle::getInverseMass() const
 {
-    return inverseMass;
+    return store->inverseMass[index];
 }
 
 bool Particle::hasFiniteMass() const
 {
-    return inverseMass >= 0.0f;
+    return store->inverseMass[index] >= 0.0f;
+}
+
+bool Particle::isAwake() const
+{
+    return store->awake[index] != 0;
 }
 
 
 void Particle::setDamping(const float damping)
 {
-    Particle::damping = damping;
+    store->damping[index] = damping;
 }
 
 float Particle::getDamping() const
 {
-    return damping;
+    return store->damping[index];
 }
 
 void Particle::setPosition(const float x, const float y)
 {
-    position.x = x;
-    position.y = y;
+    store->positionX[index] = x;
+    store->positionY[index] = y;
 }
 
 void Particle::setPosition(const Vector2 &position)
 {
-	 Particle::position = position;
+    setPosition(position.x, position.y);
 }
 
 
 Vector2 Particle::getPosition() const
 {
-    return position;
+    return Vector2(store->positionX[index], store->positionY[index]);
 }
 
 void Particle::getPosition(Vector2 *position) const
 {
-    *position = Particle::position;
+    *position = getPosition();
 }
 
 void Particle::setRadius(const float r)
 {
-    radius = r;
+    store->radius[index] = r;
 }
 
 float Particle::getRadius() const
 {
-    return radius;
+    return store->radius[index];
 }
 
 
 void Particle::setVelocity(const float x, const float y)
 {
-    velocity.x = x;
-    velocity.y = y;
+    store->velocityX[index] = x;
+    store->velocityY[index] = y;
 }
 
 void Particle::setVelocity(const Vector2 &velocity)
 {
-    Particle::velocity = velocity;
+    setVelocity(velocity.x, velocity.y);
 }
 
 Vector2 Particle::getVelocity() const
 {
-    return velocity;
+    return Vector2(store->velocityX[index], store->velocityY[index]);
 }
 
 void Particle::getVelocity(Vector2 *velocity) const
 {
-    *velocity = Particle::velocity;
+    *velocity = getVelocity();
 }
 
 void Particle::setAcceleration(const Vector2 &acceleration)
 {
-    Particle::acceleration = acceleration;
+    setAcceleration(acceleration.x, acceleration.y);
 }
 
 
 void Particle::setAcceleration(const float x, const float y)
 {
-    acceleration.x = x;
-    acceleration.y = y;
+    store->accelerationX[index] = x;
+    store->accelerationY[index] = y;
 }
 
 Vector2 Particle::getAcceleration() const
 {
-    return acceleration;
+    return Vector2(store->accelerationX[index], store->accelerationY[index]);
 }
 
 
 void Particle::clearAccumulator()
 {
-    forceAccum.clear();
+    store->forceX[index] = 0;
+    store->forceY[index] = 0;
 }
 
 void Particle::addForce(const Vector2 &force)
 {
-    forceAccum += force;
+    store->forceX[index] += force.x;
+    store->forceY[index] += force.y;
 }
-
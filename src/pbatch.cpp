@@ -0,0 +1,14 @@
+#include <pbatch.h>
+
+
+ParticleBatch::ParticleBatch(ParticleWorld &world, const void *owner)
+:
+store(world.getStore()),
+particles(world.getParticles().empty() ? NULL : &world.getParticles()[0]),
+pairs(world.getPairs().empty() ? NULL : &world.getPairs()[0]),
+pairCount((unsigned)world.getPairs().size()),
+cache(world.getContactCache()),
+owner(owner),
+featureBase(0)
+{
+}
@@ -0,0 +1,574 @@
+#include <math.h>
+#include <algorithm>
+#include <pbroadphase.h>
+
+
+namespace {
+
+    /**
+     * Appends the pair (i, j) if the circles of the two particles
+     * overlap.
+     */
+    inline void testPair(const ParticleStore &store, unsigned i, unsigned j,
+                         ParticlePairs &pairs)
+    {
+        float dx = store.positionX[j] - store.positionX[i];
+        float dy = store.positionY[j] - store.positionY[i];
+        float r = store.radius[i] + store.radius[j];
+        if (dx*dx + dy*dy < r*r)
+        {
+            ParticlePair pair;
+            pair.first = i < j ? i : j;
+            pair.second = i < j ? j : i;
+            pairs.push_back(pair);
+        }
+    }
+
+    /**
+     * Accepts the pairs of particles whose circles overlap.
+     */
+    struct OverlapTest
+    {
+        const ParticleStore &store;
+
+        OverlapTest(const ParticleStore &store) : store(store) {}
+
+        void operator()(unsigned i, unsigned j, ParticlePairs &pairs) const
+        {
+            testPair(store, i, j, pairs);
+        }
+    };
+
+    /**
+     * Accepts the pairs of particles whose centres are closer than a
+     * distance, compared squared.
+     */
+    struct DistanceTest
+    {
+        const ParticleStore &store;
+        float squareDistance;
+
+        DistanceTest(const ParticleStore &store, float distance)
+            : store(store), squareDistance(distance * distance) {}
+
+        void operator()(unsigned i, unsigned j, ParticlePairs &pairs) const
+        {
+            float dx = store.positionX[j] - store.positionX[i];
+            float dy = store.positionY[j] - store.positionY[i];
+            if (dx*dx + dy*dy < squareDistance)
+            {
+                ParticlePair pair;
+                pair.first = i < j ? i : j;
+                pair.second = i < j ? j : i;
+                pairs.push_back(pair);
+            }
+        }
+    };
+
+    inline unsigned hashCell(int x, int y)
+    {
+        return ((unsigned)x * 73856093u) ^ ((unsigned)y * 19349663u);
+    }
+
+}
+
+
+void ParticleBroadphase::setThreadPool(ThreadPool *pool)
+{
+    ParticleBroadphase::pool = pool;
+}
+
+void ParticleBroadphase::searchRanges(unsigned count, unsigned grain,
+                                      const RangeSearch &search,
+                                      ParticlePairs &pairs)
+{
+    if (!pool || pool->getThreadCount() == 1 || count <= grain)
+    {
+        search(0, count, pairs);
+        return;
+    }
+
+    // Each chunk collects into its own list; joining them in chunk
+    // order gives the same pairs in the same order as one search.
+    unsigned chunks = (count + grain - 1) / grain;
+    if (chunkPairs.size() < chunks) chunkPairs.resize(chunks);
+
+    pool->parallelFor(count, grain, [&](unsigned begin, unsigned end) {
+        ParticlePairs &chunk = chunkPairs[begin / grain];
+        chunk.clear();
+        search(begin, end, chunk);
+    });
+
+    for (unsigned c = 0; c < chunks; c++)
+    {
+        pairs.insert(pairs.end(), chunkPairs[c].begin(), chunkPairs[c].end());
+    }
+}
+
+
+ParticleHashGrid::ParticleHashGrid()
+:
+stamp(0),
+cellSize(0),
+margin(0)
+{
+}
+
+void ParticleHashGrid::setMargin(float margin)
+{
+    ParticleHashGrid::margin = margin;
+}
+
+float ParticleHashGrid::getCellSize() const
+{
+    return cellSize;
+}
+
+unsigned ParticleHashGrid::getOccupiedCells() const
+{
+    return (unsigned)occupied.size();
+}
+
+unsigned ParticleHashGrid::find(int x, int y) const
+{
+    unsigned mask = (unsigned)table.size() - 1;
+    unsigned slot = hashCell(x, y) & mask;
+
+    // Linear probing: the run of live slots ends at the first stale one.
+    while (table[slot].stamp == stamp)
+    {
+        if (table[slot].x == x && table[slot].y == y) return slot;
+        slot = (slot + 1) & mask;
+    }
+    return (unsigned)table.size();
+}
+
+unsigned ParticleHashGrid::insert(int x, int y)
+{
+    unsigned mask = (unsigned)table.size() - 1;
+    unsigned slot = hashCell(x, y) & mask;
+
+    while (table[slot].stamp == stamp)
+    {
+        if (table[slot].x == x && table[slot].y == y) return slot;
+        slot = (slot + 1) & mask;
+    }
+
+    Cell &cell = table[slot];
+    cell.x = x;
+    cell.y = y;
+    cell.stamp = stamp;
+    cell.start = 0;
+    cell.count = 0;
+    occupied.push_back(slot);
+    return slot;
+}
+
+void ParticleHashGrid::build(const ParticleStore &store, float cellSize)
+{
+    ParticleHashGrid::cellSize = cellSize;
+    unsigned count = store.size();
+
+    // Keep the table at most half full so probe runs stay short.
+    unsigned tableSize = 16;
+    while (tableSize < count * 2) tableSize *= 2;
+    if (table.size() < tableSize)
+    {
+        table.assign(tableSize, Cell());
+        stamp = 0;
+    }
+
+    // Move to a new stamp, which empties every slot at once.
+    if (++stamp == 0)
+    {
+        for (unsigned i = 0; i < table.size(); i++) table[i].stamp = 0;
+        stamp = 1;
+    }
+    occupied.clear();
+    particleCell.resize(count);
+    sorted.resize(count);
+
+    // Find each particle's cell and count the particles per cell.
+    float inverseCellSize = 1.0f / cellSize;
+    for (unsigned i = 0; i < count; i++)
+    {
+        int x = (int)floor(store.positionX[i] * inverseCellSize);
+        int y = (int)floor(store.positionY[i] * inverseCellSize);
+        unsigned slot = insert(x, y);
+        table[slot].count++;
+        particleCell[i] = slot;
+    }
+
+    // Give each cell its range of the sorted array...
+    unsigned start = 0;
+    for (unsigned c = 0; c < occupied.size(); c++)
+    {
+        Cell &cell = table[occupied[c]];
+        cell.start = start;
+        start += cell.count;
+        cell.count = 0;
+    }
+
+    // ... and scatter the particles into it.
+    for (unsigned i = 0; i < count; i++)
+    {
+        Cell &cell = table[particleCell[i]];
+        sorted[cell.start + cell.count++] = i;
+    }
+}
+
+void ParticleHashGrid::findPairs(const ParticleStore &store,
+                                 ParticlePairs &pairs)
+{
+    pairs.clear();
+
+    float maxRadius = 0;
+    for (unsigned i = 0; i < store.size(); i++)
+    {
+        if (store.radius[i] > maxRadius) maxRadius = store.radius[i];
+    }
+    if (maxRadius <= 0) return;
+
+    build(store, 2.0f * maxRadius + margin);
+
+    OverlapTest test(store);
+    searchRanges((unsigned)occupied.size(), 256,
+        [&](unsigned first, unsigned last, ParticlePairs &found) {
+        searchCells(first, last, test, found);
+    }, pairs);
+}
+
+void ParticleHashGrid::findPairsWithin(const ParticleStore &store,
+                                       float distance, ParticlePairs &pairs)
+{
+    pairs.clear();
+    if (distance <= 0 || cellSize <= 0) return;
+
+    DistanceTest test(store, distance);
+    searchRanges((unsigned)occupied.size(), 256,
+        [&](unsigned first, unsigned last, ParticlePairs &found) {
+        searchCells(first, last, test, found);
+    }, pairs);
+}
+
+void ParticleHashGrid::findNeighbours(const ParticleStore &store,
+                                      const Vector2 &point, float distance,
+                                      std::vector<unsigned> &neighbours) const
+{
+    if (distance <= 0 || cellSize <= 0 || occupied.empty()) return;
+
+    // Search every cell the circle around the point reaches.
+    float inverseCellSize = 1.0f / cellSize;
+    int minX = (int)floor((point.x - distance) * inverseCellSize);
+    int maxX = (int)floor((point.x + distance) * inverseCellSize);
+    int minY = (int)floor((point.y - distance) * inverseCellSize);
+    int maxY = (int)floor((point.y + distance) * inverseCellSize);
+    float squareDistance = distance * distance;
+
+    for (int y = minY; y <= maxY; y++)
+    {
+        for (int x = minX; x <= maxX; x++)
+        {
+            unsigned slot = find(x, y);
+            if (slot == table.size()) continue;
+
+            const Cell &cell = table[slot];
+            for (unsigned s = cell.start; s < cell.start + cell.count; s++)
+            {
+                unsigned i = sorted[s];
+                float dx = store.positionX[i] - point.x;
+                float dy = store.positionY[i] - point.y;
+                if (dx*dx + dy*dy < squareDistance) neighbours.push_back(i);
+            }
+        }
+    }
+}
+
+template <class Test>
+void ParticleHashGrid::searchCells(unsigned first, unsigned last,
+                                   const Test &test, ParticlePairs &pairs) const
+{
+    // Each cell is tested against itself and the four neighbours
+    // ahead of it, so every pair of neighbouring cells is visited once.
+    static const int offsets[4][2] = { {1, 0}, {-1, 1}, {0, 1}, {1, 1} };
+
+    for (unsigned c = first; c < last; c++)
+    {
+        const Cell &cell = table[occupied[c]];
+        const unsigned *begin = &sorted[cell.start];
+        const unsigned *end = begin + cell.count;
+
+        for (const unsigned *a = begin; a != end; a++)
+        {
+            for (const unsigned *b = a + 1; b != end; b++)
+            {
+                test(*a, *b, pairs);
+            }
+        }
+
+        for (unsigned n = 0; n < 4; n++)
+        {
+            unsigned slot = find(cell.x + offsets[n][0], cell.y + offsets[n][1]);
+            if (slot == table.size()) continue;
+
+            const Cell &other = table[slot];
+            const unsigned *otherBegin = &sorted[other.start];
+            const unsigned *otherEnd = otherBegin + other.count;
+
+            for (const unsigned *a = begin; a != end; a++)
+            {
+                for (const unsigned *b = otherBegin; b != otherEnd; b++)
+                {
+                    test(*a, *b, pairs);
+                }
+            }
+        }
+    }
+}
+
+ParticleSweepAndPrune::ParticleSweepAndPrune()
+:
+axis(0),
+swaps(0),
+resorted(false)
+{
+}
+
+unsigned ParticleSweepAndPrune::getAxis() const
+{
+    return axis;
+}
+
+unsigned ParticleSweepAndPrune::getSwaps() const
+{
+    return swaps;
+}
+
+bool ParticleSweepAndPrune::wasResorted() const
+{
+    return resorted;
+}
+
+void ParticleSweepAndPrune::findPairs(const ParticleStore &store,
+                                      ParticlePairs &pairs)
+{
+    pairs.clear();
+    swaps = 0;
+    resorted = false;
+
+    unsigned count = store.size();
+    if (count == 0)
+    {
+        entries.clear();
+        return;
+    }
+
+    // Sweep along the axis the particles are most spread out on, so
+    // that the fewest extents overlap. Only switch when the other
+    // axis is clearly better, since switching means a full sort.
+    double sum[2] = { 0, 0 };
+    double squareSum[2] = { 0, 0 };
+    for (unsigned i = 0; i < count; i++)
+    {
+        sum[0] += store.positionX[i];
+        sum[1] += store.positionY[i];
+        squareSum[0] += store.positionX[i] * store.positionX[i];
+        squareSum[1] += store.positionY[i] * store.positionY[i];
+    }
+    double variance[2];
+    for (unsigned a = 0; a < 2; a++)
+    {
+        double mean = sum[a] / count;
+        variance[a] = squareSum[a] / count - mean * mean;
+    }
+    unsigned other = 1 - axis;
+    if (variance[other] > variance[axis] * 1.25)
+    {
+        axis = other;
+        resorted = true;
+    }
+
+    if (entries.size() != count)
+    {
+        entries.resize(count);
+        for (unsigned i = 0; i < count; i++) entries[i].index = i;
+        resorted = true;
+    }
+
+    // Refresh the extents in their current order.
+    const float *position = axis == 0 ?
+        store.positionX.data() : store.positionY.data();
+    for (unsigned e = 0; e < count; e++)
+    {
+        Entry &entry = entries[e];
+        float r = store.radius[entry.index];
+        entry.min = position[entry.index] - r;
+        entry.max = position[entry.index] + r;
+    }
+
+    if (resorted)
+    {
+        std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.min < b.min; });
+    }
+    else
+    {
+        // Insertion sort: nearly linear if the order barely changed.
+        for (unsigned e = 1; e < count; e++)
+        {
+            Entry entry = entries[e];
+            unsigned f = e;
+            while (f > 0 && entries[f - 1].min > entry.min)
+            {
+                entries[f] = entries[f - 1];
+                f--;
+            }
+            entries[f] = entry;
+            swaps += e - f;
+        }
+    }
+
+    // Sweep: each extent can only overlap those starting before it
+    // ends.
+    searchRanges(count, 1024,
+        [&](unsigned first, unsigned last, ParticlePairs &found) {
+        for (unsigned e = first; e < last; e++)
+        {
+            const Entry &entry = entries[e];
+            for (unsigned f = e + 1; f < count && entries[f].min < entry.max; f++)
+            {
+                testPair(store, entry.index, entries[f].index, found);
+            }
+        }
+    }, pairs);
+}
+
+ParticleVerletList::ParticleVerletList(float skin)
+:
+builtRadius(0),
+skin(skin),
+rebuilds(0),
+rebuilt(false)
+{
+}
+
+void ParticleVerletList::setSkin(float skin)
+{
+    ParticleVerletList::skin = skin;
+
+    // Forget the built positions, so the next call rebuilds.
+    builtX.clear();
+    builtY.clear();
+}
+
+float ParticleVerletList::getSkin() const
+{
+    return skin;
+}
+
+unsigned ParticleVerletList::getRebuildCount() const
+{
+    return rebuilds;
+}
+
+bool ParticleVerletList::wasRebuilt() const
+{
+    return rebuilt;
+}
+
+unsigned ParticleVerletList::getNeighbourCount() const
+{
+    return (unsigned)neighbours.size();
+}
+
+bool ParticleVerletList::needsRebuild(const ParticleStore &store,
+                                      float maxRadius) const
+{
+    unsigned count = store.size();
+    if (builtX.size() != count || maxRadius > builtRadius) return true;
+
+    // Two particles that have each moved at most half the skin can
+    // only have closed the gap between them by the skin.
+    float limit = 0.5f * skin;
+    float squareLimit = limit * limit;
+    for (unsigned i = 0; i < count; i++)
+    {
+        float dx = store.positionX[i] - builtX[i];
+        float dy = store.positionY[i] - builtY[i];
+        if (dx*dx + dy*dy > squareLimit) return true;
+    }
+    return false;
+}
+
+void ParticleVerletList::build(const ParticleStore &store, float maxRadius)
+{
+    unsigned count = store.size();
+
+    // Every pair that could overlap after a move of the skin.
+    float reach = 2.0f * maxRadius + skin;
+    grid.setThreadPool(pool);
+    grid.build(store, reach);
+    grid.findPairsWithin(store, reach, candidates);
+
+    // Count each particle's neighbours, turn the counts into the end
+    // of each run, then fill the runs from the back, which leaves
+    // each entry of neighbourStart at the start of its run.
+    neighbourStart.assign(count + 1, 0);
+    for (unsigned p = 0; p < candidates.size(); p++)
+    {
+        neighbourStart[candidates[p].first]++;
+    }
+    for (unsigned i = 1; i <= count; i++)
+    {
+        neighbourStart[i] += neighbourStart[i - 1];
+    }
+    neighbours.resize(candidates.size());
+    for (unsigned p = (unsigned)candidates.size(); p-- > 0; )
+    {
+        neighbours[--neighbourStart[candidates[p].first]] = candidates[p].second;
+    }
+
+    // Sorted runs read the store in order.
+    for (unsigned i = 0; i < count; i++)
+    {
+        std::sort(neighbours.begin() + neighbourStart[i],
+                  neighbours.begin() + neighbourStart[i + 1]);
+    }
+
+    builtX = store.positionX;
+    builtY = store.positionY;
+    builtRadius = maxRadius;
+    rebuilds++;
+}
+
+void ParticleVerletList::findPairs(const ParticleStore &store,
+                                   ParticlePairs &pairs)
+{
+    pairs.clear();
+    rebuilt = false;
+
+    float maxRadius = 0;
+    for (unsigned i = 0; i < store.size(); i++)
+    {
+        if (store.radius[i] > maxRadius) maxRadius = store.radius[i];
+    }
+    if (maxRadius <= 0) return;
+
+    if (needsRebuild(store, maxRadius))
+    {
+        build(store, maxRadius);
+        rebuilt = true;
+    }
+
+    // Only the listed pairs can overlap.
+    searchRanges(store.size(), 4096,
+        [&](unsigned first, unsigned last, ParticlePairs &found) {
+        for (unsigned i = first; i < last; i++)
+        {
+            for (unsigned n = neighbourStart[i]; n < neighbourStart[i + 1]; n++)
+            {
+                testPair(store, i, neighbours[n], found);
+            }
+        }
+    }, pairs);
+}
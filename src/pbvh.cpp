@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <pbvh.h>
+
+
+namespace {
+
+    /**
+     * Orders segment indices by the centre of their bounds along one
+     * axis.
+     */
+    struct CentreLess
+    {
+        const std::vector<Vector2> &min;
+        const std::vector<Vector2> &max;
+        unsigned axis;
+
+        CentreLess(const std::vector<Vector2> &min,
+                   const std::vector<Vector2> &max, unsigned axis)
+            : min(min), max(max), axis(axis) {}
+
+        bool operator()(unsigned a, unsigned b) const
+        {
+            return min[a][axis] + max[a][axis] < min[b][axis] + max[b][axis];
+        }
+    };
+
+}
+
+
+void SegmentBVH::build(const Segments &segments)
+{
+    unsigned count = (unsigned)segments.size();
+
+    nodes.clear();
+    order.resize(count);
+    segmentMin.resize(count);
+    segmentMax.resize(count);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Segment &s = segments[i];
+        segmentMin[i] = Vector2(std::min(s.start.x, s.end.x), std::min(s.start.y, s.end.y));
+        segmentMax[i] = Vector2(std::max(s.start.x, s.end.x), std::max(s.start.y, s.end.y));
+        order[i] = i;
+    }
+
+    if (count == 0) return;
+
+    // A median split tree over n segments has fewer than 2n / leaf
+    // size nodes, give or take rounding.
+    nodes.reserve(2 * (count / MAX_LEAF_SIZE + 1));
+    buildNode(0, count);
+}
+
+unsigned SegmentBVH::getNodeCount() const
+{
+    return (unsigned)nodes.size();
+}
+
+unsigned SegmentBVH::buildNode(unsigned start, unsigned count)
+{
+    unsigned index = (unsigned)nodes.size();
+    nodes.push_back(Node());
+
+    // Find the bounds of the segments, and of their centres.
+    Vector2 min = segmentMin[order[start]];
+    Vector2 max = segmentMax[order[start]];
+    Vector2 centreMin = (min + max) * 0.5f;
+    Vector2 centreMax = centreMin;
+    for (unsigned i = start + 1; i < start + count; i++)
+    {
+        unsigned s = order[i];
+        min = Vector2(std::min(min.x, segmentMin[s].x), std::min(min.y, segmentMin[s].y));
+        max = Vector2(std::max(max.x, segmentMax[s].x), std::max(max.y, segmentMax[s].y));
+
+        Vector2 centre = (segmentMin[s] + segmentMax[s]) * 0.5f;
+        centreMin = Vector2(std::min(centreMin.x, centre.x), std::min(centreMin.y, centre.y));
+        centreMax = Vector2(std::max(centreMax.x, centre.x), std::max(centreMax.y, centre.y));
+    }
+
+    nodes[index].min = min;
+    nodes[index].max = max;
+    nodes[index].start = start;
+    nodes[index].count = count;
+    nodes[index].right = 0;
+
+    if (count <= MAX_LEAF_SIZE) return index;
+
+    // Split at the median centre along the axis the centres spread
+    // furthest on.
+    Vector2 extent = centreMax - centreMin;
+    unsigned axis = extent.x >= extent.y ? 0 : 1;
+    unsigned half = count / 2;
+    std::nth_element(order.begin() + start, order.begin() + start + half,
+        order.begin() + start + count, CentreLess(segmentMin, segmentMax, axis));
+
+    nodes[index].count = 0;
+    buildNode(start, half);
+    unsigned right = buildNode(start + half, count - half);
+    nodes[index].right = right;
+
+    return index;
+}
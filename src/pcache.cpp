@@ -0,0 +1,265 @@
+#include <stdint.h>
+#include <algorithm>
+#include <pcache.h>
+
+
+namespace {
+
+    inline unsigned hashKey(const void *owner, unsigned first, unsigned second)
+    {
+        return ((unsigned)(uintptr_t)owner * 2654435761u) ^
+            (first * 73856093u) ^ (second * 19349663u);
+    }
+
+    const unsigned SCENERY_BIT = 0x80000000u;
+
+}
+
+
+ParticleContactCache::ParticleContactCache()
+:
+current(0),
+enabled(false),
+warmStartFactor(1.0f),
+motionThreshold(0),
+reusedCount(0)
+{
+    tables[0].stamp = 0;
+    tables[1].stamp = 0;
+}
+
+void ParticleContactCache::setEnabled(bool enabled)
+{
+    ParticleContactCache::enabled = enabled;
+}
+
+bool ParticleContactCache::isEnabled() const
+{
+    return enabled;
+}
+
+void ParticleContactCache::setWarmStartFactor(float warmStartFactor)
+{
+    ParticleContactCache::warmStartFactor = warmStartFactor;
+}
+
+float ParticleContactCache::getWarmStartFactor() const
+{
+    return warmStartFactor;
+}
+
+void ParticleContactCache::setMotionThreshold(float motionThreshold)
+{
+    ParticleContactCache::motionThreshold = motionThreshold;
+}
+
+float ParticleContactCache::getMotionThreshold() const
+{
+    return motionThreshold;
+}
+
+unsigned ParticleContactCache::getReusedCount() const
+{
+    return reusedCount;
+}
+
+unsigned ParticleContactCache::sceneryKey(unsigned feature)
+{
+    return feature | SCENERY_BIT;
+}
+
+unsigned ParticleContactCache::find(const Table &table, const void *owner,
+                                    unsigned first, unsigned second) const
+{
+    unsigned size = (unsigned)table.entries.size();
+    if (size == 0) return 0;
+
+    unsigned mask = size - 1;
+    unsigned slot = hashKey(owner, first, second) & mask;
+
+    // Linear probing: the run of live slots ends at the first stale one.
+    while (table.entries[slot].stamp == table.stamp)
+    {
+        const Entry &entry = table.entries[slot];
+        if (entry.owner == owner && entry.first == first &&
+            entry.second == second) return slot;
+        slot = (slot + 1) & mask;
+    }
+    return size;
+}
+
+bool ParticleContactCache::reuseEntry(const Entry &entry, bool scenery,
+                                      const Vector2 &position0,
+                                      const Vector2 &position1,
+                                      Vector2 *normal, float *penetration) const
+{
+    if (motionThreshold <= 0) return false;
+
+    Vector2 moved = position0 - entry.base[0];
+    if (!scenery) moved -= position1 - entry.base[1];
+    if (moved.squareMagnitude() >= motionThreshold * motionThreshold) return false;
+
+    // Moving the first particle along the normal takes it out of the
+    // contact.
+    *normal = entry.normal;
+    *penetration = entry.penetration - moved * entry.normal;
+    return true;
+}
+
+bool ParticleContactCache::reuse(const void *owner, unsigned first,
+                                 unsigned second, const Vector2 &position0,
+                                 const Vector2 &position1, Vector2 *normal,
+                                 float *penetration) const
+{
+    if (!enabled) return false;
+
+    // Until startFrame, the current table still holds last frame's.
+    const Table &table = tables[current];
+    unsigned slot = find(table, owner, first, second);
+    if (slot == table.entries.size()) return false;
+
+    return reuseEntry(table.entries[slot], (second & SCENERY_BIT) != 0,
+                      position0, position1, normal, penetration);
+}
+
+void ParticleContactCache::startFrame(unsigned count)
+{
+    current ^= 1;
+    Table &table = tables[current];
+
+    // Keep the table at most half full so probe runs stay short.
+    unsigned size = 16;
+    while (size < count * 2) size *= 2;
+    if (table.entries.size() < size)
+    {
+        table.entries.assign(size, Entry());
+        table.stamp = 0;
+    }
+
+    // Move to a new stamp, which empties every slot at once.
+    if (++table.stamp == 0)
+    {
+        for (unsigned i = 0; i < table.entries.size(); i++) table.entries[i].stamp = 0;
+        table.stamp = 1;
+    }
+
+    contactSlot.resize(count);
+    reusedCount = 0;
+}
+
+void ParticleContactCache::store(const void *owner,
+                                 const ParticleContact *contacts,
+                                 unsigned begin, unsigned end)
+{
+    Table &table = tables[current];
+    const Table &previous = tables[current ^ 1];
+    unsigned mask = (unsigned)table.entries.size() - 1;
+
+    for (unsigned c = begin; c < end; c++)
+    {
+        const ParticleContact &contact = contacts[c];
+        bool scenery = contact.particle[1] == NULL;
+        unsigned first = contact.particle[0]->getIndex();
+        unsigned second = scenery ? sceneryKey(contact.feature) :
+            contact.particle[1]->getIndex();
+        Vector2 position0 = contact.particle[0]->getPosition();
+        Vector2 position1 = scenery ? Vector2() : contact.particle[1]->getPosition();
+
+        unsigned slot = hashKey(owner, first, second) & mask;
+        while (table.entries[slot].stamp == table.stamp) slot = (slot + 1) & mask;
+
+        Entry &entry = table.entries[slot];
+        entry.owner = owner;
+        entry.first = first;
+        entry.second = second;
+        entry.stamp = table.stamp;
+        entry.impulse = 0;
+        entry.previousImpulse = 0;
+        contactSlot[c] = slot;
+
+        // A contact whose geometry the generator reused keeps the
+        // positions that geometry was worked out at, so the error
+        // does not build up over frames.
+        unsigned previousSlot = find(previous, owner, first, second);
+        if (previousSlot < previous.entries.size())
+        {
+            const Entry &match = previous.entries[previousSlot];
+            entry.previousImpulse = match.impulse;
+
+            Vector2 normal;
+            float penetration;
+            if (reuseEntry(match, scenery, position0, position1,
+                           &normal, &penetration))
+            {
+                entry.normal = match.normal;
+                entry.penetration = match.penetration;
+                entry.base[0] = match.base[0];
+                entry.base[1] = match.base[1];
+                reusedCount++;
+                continue;
+            }
+        }
+
+        entry.normal = contact.contactNormal;
+        entry.penetration = contact.penetration;
+        entry.base[0] = position0;
+        entry.base[1] = position1;
+    }
+}
+
+void ParticleContactCache::warmStart(ParticleContact *contacts, unsigned count)
+{
+    const Table &table = tables[current];
+
+    for (unsigned c = 0; c < count; c++)
+    {
+        ParticleContact &contact = contacts[c];
+        contact.accumulatedImpulse = 0;
+        if (c >= contactSlot.size()) continue;
+
+        float cached = table.entries[contactSlot[c]].previousImpulse * warmStartFactor;
+        if (cached <= 0) continue;
+
+        // A contact already separating is coming apart, perhaps
+        // from last frame's bounce, and gets nothing.
+        if (contact.calculateSeparatingVelocity() > 0) continue;
+
+        contact.applyImpulse(cached);
+        contact.accumulatedImpulse = cached;
+    }
+
+    // Together the impulses can push harder than the contacts now
+    // need. The resolver only ever pushes, so take back whatever
+    // leaves a contact separating, down to none of what was applied.
+    for (unsigned sweep = 0; sweep < 2; sweep++)
+    {
+        for (unsigned c = 0; c < count; c++)
+        {
+            ParticleContact &contact = contacts[c];
+            if (contact.accumulatedImpulse <= 0) continue;
+
+            float separatingVelocity = contact.calculateSeparatingVelocity();
+            if (separatingVelocity <= 0) continue;
+
+            float totalInverseMass = contact.particle[0]->getInverseMass();
+            if (contact.particle[1]) totalInverseMass += contact.particle[1]->getInverseMass();
+            if (totalInverseMass <= 0) continue;
+
+            float excess = std::min(contact.accumulatedImpulse,
+                                    separatingVelocity / totalInverseMass);
+            contact.applyImpulse(-excess);
+            contact.accumulatedImpulse -= excess;
+        }
+    }
+}
+
+void ParticleContactCache::storeImpulses(const ParticleContact *contacts,
+                                         unsigned count)
+{
+    Table &table = tables[current];
+    unsigned stored = std::min(count, (unsigned)contactSlot.size());
+    for (unsigned c = 0; c < stored; c++)
+    {
+        table.entries[contactSlot[c]].impulse = contacts[c].accumulatedImpulse;
+    }
+}
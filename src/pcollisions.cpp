@@ -0,0 +1,79 @@
+#include <math.h>
+#include <pcollisions.h>
+
+
+ParticleCollisions::ParticleCollisions(ParticleWorld *world, float restitution)
+:
+ParticleBatchGenerator<ParticleCollisions>(world),
+restitution(restitution)
+{
+}
+
+unsigned ParticleCollisions::getFeatureCount() const
+{
+    return 0;
+}
+
+unsigned ParticleCollisions::addContacts(const ParticleBatch &batch,
+                                         ParticleContact *contact,
+                                         unsigned limit) const
+{
+    const ParticleStore &store = batch.store;
+    Particle *const *particles = batch.particles;
+    const ParticlePair *pairs = batch.pairs;
+
+    unsigned used = 0;
+    for (unsigned p = 0; p < batch.pairCount; p++)
+    {
+        if (used >= limit) return used;
+
+        unsigned i = pairs[p].first;
+        unsigned j = pairs[p].second;
+
+        // A pair that has barely moved since last frame can keep its
+        // contact, corrected for the movement.
+        if (batch.cache.reuse(batch.owner, i, j,
+                Vector2(store.positionX[i], store.positionY[i]),
+                Vector2(store.positionX[j], store.positionY[j]),
+                &contact->contactNormal, &contact->penetration))
+        {
+            if (contact->penetration <= 0) continue;
+
+            contact->particle[0] = particles[i];
+            contact->particle[1] = particles[j];
+            contact->restitution = restitution;
+            contact++;
+            used++;
+            continue;
+        }
+
+        float dx = store.positionX[i] - store.positionX[j];
+        float dy = store.positionY[i] - store.positionY[j];
+        float radius = store.radius[i] + store.radius[j];
+        float squareDistance = dx*dx + dy*dy;
+
+        // The broadphase only reports overlapping pairs, but check
+        // anyway in case the particles moved since it ran.
+        if (squareDistance >= radius*radius) continue;
+
+        // The normal points from the second particle to the first.
+        // Coincident particles are pushed apart vertically.
+        float distance = sqrt(squareDistance);
+        if (distance > 0)
+        {
+            contact->contactNormal = Vector2(dx / distance, dy / distance);
+        }
+        else
+        {
+            contact->contactNormal = Vector2(0, 1);
+        }
+
+        contact->particle[0] = particles[i];
+        contact->particle[1] = particles[j];
+        contact->restitution = restitution;
+        contact->penetration = radius - distance;
+        contact++;
+        used++;
+    }
+    return used;
+}
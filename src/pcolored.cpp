@@ -0,0 +1,169 @@
+#include <pcolored.h>
+
+
+ParticleColoredResolver::ParticleColoredResolver(ThreadPool *pool,
+                                                 unsigned iterations,
+                                                 float tolerance)
+:
+pool(pool),
+iterations(iterations),
+iterationsUsed(0),
+tolerance(tolerance),
+grain(256),
+colorsUsed(0)
+{
+}
+
+void ParticleColoredResolver::setThreadPool(ThreadPool *pool)
+{
+    ParticleColoredResolver::pool = pool;
+}
+
+ThreadPool* ParticleColoredResolver::getThreadPool() const
+{
+    return pool;
+}
+
+void ParticleColoredResolver::setIterations(unsigned iterations)
+{
+    ParticleColoredResolver::iterations = iterations;
+}
+
+void ParticleColoredResolver::setTolerance(float tolerance)
+{
+    ParticleColoredResolver::tolerance = tolerance;
+}
+
+void ParticleColoredResolver::setGrain(unsigned grain)
+{
+    ParticleColoredResolver::grain = grain;
+}
+
+unsigned ParticleColoredResolver::getIterationsUsed() const
+{
+    return iterationsUsed;
+}
+
+unsigned ParticleColoredResolver::getColorCount() const
+{
+    return colorsUsed;
+}
+
+void ParticleColoredResolver::colorContacts(const ParticleContact *contactArray,
+                                            unsigned numContacts)
+{
+    // Size the colour sets by the highest particle index in use.
+    unsigned numParticles = 0;
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        for (unsigned k = 0; k < 2; k++)
+        {
+            const Particle *particle = contactArray[c].particle[k];
+            if (particle && particle->getIndex() >= numParticles)
+            {
+                numParticles = particle->getIndex() + 1;
+            }
+        }
+    }
+    particleColors.assign(numParticles, 0);
+
+    // Greedy colouring: give each contact the lowest colour neither
+    // of its particles has yet. Contacts with the scenery only
+    // involve one particle.
+    contactColor.resize(numContacts);
+    colorStart.assign(MAX_COLORS + 2, 0);
+    colorsUsed = 0;
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        const Particle *first = contactArray[c].particle[0];
+        const Particle *second = contactArray[c].particle[1];
+
+        unsigned long long used = particleColors[first->getIndex()];
+        if (second) used |= particleColors[second->getIndex()];
+
+        unsigned color = 0;
+        while (color < MAX_COLORS && (used & (1ULL << color))) color++;
+
+        if (color < MAX_COLORS)
+        {
+            particleColors[first->getIndex()] |= 1ULL << color;
+            if (second) particleColors[second->getIndex()] |= 1ULL << color;
+            if (color + 1 > colorsUsed) colorsUsed = color + 1;
+        }
+        contactColor[c] = color;
+        colorStart[color + 1]++;
+    }
+
+    // Sort the contacts into their batches.
+    for (unsigned color = 0; color <= MAX_COLORS; color++)
+    {
+        colorStart[color + 1] += colorStart[color];
+    }
+    order.resize(numContacts);
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        order[colorStart[contactColor[c]]++] = c;
+    }
+    for (unsigned color = MAX_COLORS + 1; color > 0; color--)
+    {
+        colorStart[color] = colorStart[color - 1];
+    }
+    colorStart[0] = 0;
+}
+
+void ParticleColoredResolver::resolveContacts(ParticleContact *contactArray,
+                                              unsigned numContacts,
+                                              float duration)
+{
+    iterationsUsed = 0;
+    if (numContacts == 0) return;
+
+    colorContacts(contactArray, numContacts);
+
+    const float threshold = -tolerance;
+    std::atomic<unsigned> resolved;
+
+    // Resolves the contacts order[begin, end) that are closing, and
+    // counts them.
+    const unsigned *batch = NULL;
+    ThreadPool::RangeJob job = [&](unsigned begin, unsigned end) {
+        unsigned count = 0;
+        for (unsigned i = begin; i < end; i++)
+        {
+            ParticleContact &contact = contactArray[batch[i]];
+            if (contact.calculateSeparatingVelocity() < threshold)
+            {
+                contact.resolve(duration);
+                count++;
+            }
+        }
+        if (count) resolved.fetch_add(count);
+    };
+
+    while (iterationsUsed < iterations)
+    {
+        resolved = 0;
+
+        for (unsigned color = 0; color < colorsUsed; color++)
+        {
+            unsigned start = colorStart[color];
+            batch = &order[start];
+
+            // Without a pool, each batch runs on the calling thread.
+            unsigned count = colorStart[color + 1] - start;
+            if (pool) pool->parallelFor(count, grain, job);
+            else job(0, count);
+        }
+
+        // Contacts that did not fit in a colour go one at a time.
+        unsigned start = colorStart[MAX_COLORS];
+        if (start < numContacts)
+        {
+            batch = &order[start];
+            job(0, numContacts - start);
+        }
+
+        iterationsUsed++;
+        if (resolved == 0) break;
+    }
+}
@@ -1,5 +1,6 @@
 
 #include <float.h>
+#include <math.h>
 #include <pcontacts.h>
 
 
@@ -44,7 +45,12 @@ void ParticleContact::resolveVelocity(float duration)
 
     // Calculate the impulse to apply
     float impulse = deltaVelocity / totalInverseMass;
+    applyImpulse(impulse);
+    accumulatedImpulse += impulse;
+}
 
+void ParticleContact::applyImpulse(float impulse)
+{
     // Find the amount of impulse per unit of inverse mass
     Vector2 impulsePerIMass = contactNormal * impulse;
 
@@ -62,9 +68,12 @@ void ParticleContact::resolveVelocity(float duration)
     }
 }
 
-ParticleContactResolver::ParticleContactResolver(unsigned iterations)
+ParticleContactResolver::ParticleContactResolver(unsigned iterations, Mode mode)
 :
-iterations(iterations)
+iterations(iterations),
+iterationsUsed(0),
+mode(mode),
+tolerance(0)
 {
 }
 
@@ -73,9 +82,37 @@ void ParticleContactResolver::setIterations(unsigned iterations)
     ParticleContactResolver::iterations = iterations;
 }
 
+void ParticleContactResolver::setMode(Mode mode)
+{
+    ParticleContactResolver::mode = mode;
+}
+
+ParticleContactResolver::Mode ParticleContactResolver::getMode() const
+{
+    return mode;
+}
+
+void ParticleContactResolver::setTolerance(float tolerance)
+{
+    ParticleContactResolver::tolerance = tolerance;
+}
+
+unsigned ParticleContactResolver::getIterationsUsed() const
+{
+    return iterationsUsed;
+}
+
 void ParticleContactResolver::resolveContacts(ParticleContact *contactArray,
                                               unsigned numContacts,
                                               float duration)
+{
+    if (mode == MODE_HEAP) resolveByHeap(contactArray, numContacts, duration);
+    else resolveByScan(contactArray, numContacts, duration);
+}
+
+void ParticleContactResolver::resolveByScan(ParticleContact *contactArray,
+                                            unsigned numContacts,
+                                            float duration)
 {
     unsigned i;
 
@@ -88,8 +125,7 @@ void ParticleContactResolver::resolveContacts(ParticleContact *contactArray,
         for (i = 0; i < numContacts; i++)
         {
             float sepVel = contactArray[i].calculateSeparatingVelocity();
-            if (sepVel < max &&
-                (sepVel < 0 || contactArray[i].penetration > 0))
+            if (sepVel < max && sepVel < -tolerance)
             {
                 max = sepVel;
                 maxIndex = i;
@@ -104,4 +140,249 @@ void ParticleContactResolver::resolveContacts(ParticleContact *contactArray,
         iterationsUsed++;
     }
 
-}
\ No newline at end of file
+}
+
+void ParticleContactResolver::buildAdjacency(const ParticleContact *contactArray,
+                                             unsigned numContacts)
+{
+    // Size the table by the highest particle index in use.
+    unsigned numParticles = 0;
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        for (unsigned k = 0; k < 2; k++)
+        {
+            const Particle *particle = contactArray[c].particle[k];
+            if (particle && particle->getIndex() >= numParticles)
+            {
+                numParticles = particle->getIndex() + 1;
+            }
+        }
+    }
+
+    // Count the contacts per particle, turn the counts into offsets,
+    // then drop each contact into its particles' ranges.
+    adjacencyStart.assign(numParticles + 1, 0);
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        for (unsigned k = 0; k < 2; k++)
+        {
+            const Particle *particle = contactArray[c].particle[k];
+            if (particle) adjacencyStart[particle->getIndex() + 1]++;
+        }
+    }
+    for (unsigned p = 0; p < numParticles; p++)
+    {
+        adjacencyStart[p + 1] += adjacencyStart[p];
+    }
+
+    adjacency.resize(adjacencyStart[numParticles]);
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        for (unsigned k = 0; k < 2; k++)
+        {
+            const Particle *particle = contactArray[c].particle[k];
+            if (particle) adjacency[adjacencyStart[particle->getIndex()]++] = c;
+        }
+    }
+
+    // Filling advanced each start to the next particle's; shift back.
+    for (unsigned p = numParticles; p > 0; p--)
+    {
+        adjacencyStart[p] = adjacencyStart[p - 1];
+    }
+    adjacencyStart[0] = 0;
+}
+
+bool ParticleContactResolver::heapBefore(unsigned a, unsigned b) const
+{
+    // Ties go to the lower index, as they do when scanning.
+    return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+}
+
+void ParticleContactResolver::siftUp(unsigned slot)
+{
+    unsigned contact = heap[slot];
+    while (slot > 0)
+    {
+        unsigned parent = (slot - 1) / 2;
+        if (!heapBefore(contact, heap[parent])) break;
+        heap[slot] = heap[parent];
+        heapSlot[heap[slot]] = slot;
+        slot = parent;
+    }
+    heap[slot] = contact;
+    heapSlot[contact] = slot;
+}
+
+void ParticleContactResolver::siftDown(unsigned slot)
+{
+    unsigned contact = heap[slot];
+    unsigned size = (unsigned)heap.size();
+    for (;;)
+    {
+        unsigned child = 2 * slot + 1;
+        if (child >= size) break;
+        if (child + 1 < size && heapBefore(heap[child + 1], heap[child])) child++;
+        if (!heapBefore(heap[child], contact)) break;
+        heap[slot] = heap[child];
+        heapSlot[heap[slot]] = slot;
+        slot = child;
+    }
+    heap[slot] = contact;
+    heapSlot[contact] = slot;
+}
+
+void ParticleContactResolver::resolveByHeap(ParticleContact *contactArray,
+                                            unsigned numContacts,
+                                            float duration)
+{
+    iterationsUsed = 0;
+    if (numContacts == 0 || iterations == 0) return;
+
+    buildAdjacency(contactArray, numContacts);
+
+    // Key every contact: contacts that are not closing faster than
+    // the tolerance need no impulse, so sink them to the bottom of
+    // the heap.
+    keys.resize(numContacts);
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        float sepVel = contactArray[c].calculateSeparatingVelocity();
+        keys[c] = sepVel < -tolerance ? sepVel : HUGE_VALF;
+    }
+
+    heap.resize(numContacts);
+    heapSlot.resize(numContacts);
+    for (unsigned c = 0; c < numContacts; c++) heap[c] = c;
+    for (unsigned slot = numContacts / 2; slot-- > 0;) siftDown(slot);
+    for (unsigned slot = 0; slot < numContacts; slot++) heapSlot[heap[slot]] = slot;
+
+    while(iterationsUsed < iterations)
+    {
+        // Do we have anything worth resolving?
+        unsigned top = heap[0];
+        if (!(keys[top] < HUGE_VALF)) break;
+
+        contactArray[top].resolve(duration);
+        iterationsUsed++;
+
+        // Only contacts sharing a particle with this one have changed.
+        for (unsigned k = 0; k < 2; k++)
+        {
+            const Particle *particle = contactArray[top].particle[k];
+            if (!particle) continue;
+
+            unsigned p = particle->getIndex();
+            for (unsigned a = adjacencyStart[p]; a < adjacencyStart[p + 1]; a++)
+            {
+                unsigned c = adjacency[a];
+                float sepVel = contactArray[c].calculateSeparatingVelocity();
+                float key = sepVel < -tolerance ? sepVel : HUGE_VALF;
+                if (key == keys[c]) continue;
+
+                float old = keys[c];
+                keys[c] = key;
+                if (key < old) siftUp(heapSlot[c]);
+                else siftDown(heapSlot[c]);
+            }
+        }
+    }
+}
+
+ParticlePositionCorrector::ParticlePositionCorrector(float factor, float slop)
+:
+enabled(false),
+factor(factor),
+slop(slop)
+{
+}
+
+void ParticlePositionCorrector::setEnabled(bool enabled)
+{
+    ParticlePositionCorrector::enabled = enabled;
+}
+
+bool ParticlePositionCorrector::isEnabled() const
+{
+    return enabled;
+}
+
+void ParticlePositionCorrector::setFactor(float factor)
+{
+    ParticlePositionCorrector::factor = factor;
+}
+
+float ParticlePositionCorrector::getFactor() const
+{
+    return factor;
+}
+
+void ParticlePositionCorrector::setSlop(float slop)
+{
+    ParticlePositionCorrector::slop = slop;
+}
+
+float ParticlePositionCorrector::getSlop() const
+{
+    return slop;
+}
+
+void ParticlePositionCorrector::correctPositions(ParticleStore &store,
+                                                 ParticleContact *contactArray,
+                                                 unsigned numContacts)
+{
+    first.resize(numContacts);
+    second.resize(numContacts);
+    normalX.resize(numContacts);
+    normalY.resize(numContacts);
+    depth.resize(numContacts);
+    weight0.resize(numContacts);
+    weight1.resize(numContacts);
+
+    // Gather the contacts into flat arrays.
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        const ParticleContact &contact = contactArray[c];
+        unsigned i = contact.particle[0]->getIndex();
+        unsigned j = contact.particle[1] ? contact.particle[1]->getIndex() : i;
+
+        first[c] = i;
+        second[c] = j;
+        normalX[c] = contact.contactNormal.x;
+        normalY[c] = contact.contactNormal.y;
+        depth[c] = contact.penetration;
+        weight0[c] = store.inverseMass[i];
+        weight1[c] = contact.particle[1] ? store.inverseMass[j] : 0;
+    }
+
+    // Work out each contact's share of the correction per unit of
+    // inverse mass. No branches, so this loop vectorises; weights are
+    // scaled in place to become the distance each particle moves.
+    float *d = depth.data();
+    float *w0 = weight0.data();
+    float *w1 = weight1.data();
+    const float slop = ParticlePositionCorrector::slop;
+    const float factor = ParticlePositionCorrector::factor;
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        float totalInverseMass = w0[c] + w1[c];
+        float excess = d[c] - slop;
+        excess = excess > 0 && totalInverseMass > 0 ? excess * factor : 0;
+        float share = excess / (totalInverseMass > 0 ? totalInverseMass : 1.0f);
+
+        w0[c] *= share;
+        w1[c] *= share;
+        d[c] -= excess;
+    }
+
+    // Scatter the moves into the positions: the first particle moves
+    // along the normal, the second against it.
+    for (unsigned c = 0; c < numContacts; c++)
+    {
+        store.positionX[first[c]] += normalX[c] * w0[c];
+        store.positionY[first[c]] += normalY[c] * w0[c];
+        store.positionX[second[c]] -= normalX[c] * w1[c];
+        store.positionY[second[c]] -= normalY[c] * w1[c];
+        contactArray[c].penetration = d[c];
+    }
+}
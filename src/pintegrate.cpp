@@ -0,0 +1,372 @@
+#include <math.h>
+#include <assert.h>
+#include <pintegrate.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PINTEGRATE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit vector instructions in functions that are
+// compiled for them; MSVC accepts the intrinsics anywhere.
+#if defined(PINTEGRATE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PINTEGRATE_TARGET_SSE2 __attribute__((target("sse2")))
+#define PINTEGRATE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PINTEGRATE_TARGET_SSE2
+#define PINTEGRATE_TARGET_AVX2
+#endif
+
+
+namespace {
+
+    /**
+     * Caches pow(damping, duration) for the distinct damping values
+     * met during one integration call. Scenes normally use a handful
+     * of damping values, so the table rarely fills; when it does the
+     * factor is computed directly.
+     */
+    class DragTable
+    {
+        enum { SIZE = 16 };
+
+        float duration;
+        unsigned count;
+        unsigned last;
+        float damping[SIZE];
+        float factor[SIZE];
+
+    public:
+        DragTable(float duration) : duration(duration), count(0), last(0) {}
+
+        /** Returns the damping value that was looked up last. */
+        float lastDamping() const
+        {
+            return count ? damping[last] : NAN;
+        }
+
+        /** Returns the factor for the damping value looked up last. */
+        float lastFactor() const
+        {
+            return factor[last];
+        }
+
+        /** Returns the drag factor for the given damping value. */
+        float lookup(float d)
+        {
+            if (count && damping[last] == d) return factor[last];
+            for (unsigned i = 0; i < count; i++)
+            {
+                if (damping[i] == d)
+                {
+                    last = i;
+                    return factor[i];
+                }
+            }
+
+            float f = pow(d, duration);
+            if (count == SIZE) return f;
+            damping[count] = d;
+            factor[count] = f;
+            last = count++;
+            return f;
+        }
+    };
+
+    /**
+     * Pointers to the arrays of the store, offset to the start of the
+     * range being integrated.
+     */
+    struct Channels
+    {
+        float *px, *py, *vx, *vy, *fx, *fy;
+        const float *ax, *ay, *w, *d;
+
+        Channels(ParticleStore &store, unsigned begin)
+        {
+            px = store.positionX.data() + begin;
+            py = store.positionY.data() + begin;
+            vx = store.velocityX.data() + begin;
+            vy = store.velocityY.data() + begin;
+            fx = store.forceX.data() + begin;
+            fy = store.forceY.data() + begin;
+            ax = store.accelerationX.data() + begin;
+            ay = store.accelerationY.data() + begin;
+            w = store.inverseMass.data() + begin;
+            d = store.damping.data() + begin;
+        }
+    };
+
+    void integrateScalar(Channels &c, unsigned begin, unsigned end,
+        float duration, DragTable &drag)
+    {
+        for (unsigned i = begin; i < end; i++)
+        {
+            // We don't integrate things with zero mass.
+            if (c.w[i] <= 0.0f) continue;
+
+            c.px[i] += c.vx[i] * duration;
+            c.py[i] += c.vy[i] * duration;
+
+            float f = drag.lookup(c.d[i]);
+            c.vx[i] = (c.vx[i] + (c.ax[i] + c.fx[i] * c.w[i]) * duration) * f;
+            c.vy[i] = (c.vy[i] + (c.ay[i] + c.fy[i] * c.w[i]) * duration) * f;
+
+            c.fx[i] = 0;
+            c.fy[i] = 0;
+        }
+    }
+
+#ifdef PINTEGRATE_X86
+
+    PINTEGRATE_TARGET_SSE2
+    void integrateSSE2(Channels &c, unsigned count, float duration,
+        DragTable &drag)
+    {
+        const __m128 dt = _mm_set1_ps(duration);
+        const __m128 zero = _mm_setzero_ps();
+
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 w = _mm_loadu_ps(c.w + i);
+
+            // Immovable particles keep their state untouched.
+            __m128 movable = _mm_cmpgt_ps(w, zero);
+            if (_mm_movemask_ps(movable) == 0) continue;
+
+            // Most runs of particles share a damping value, so only
+            // fall back to per-lane lookups when they differ.
+            __m128 d = _mm_loadu_ps(c.d + i);
+            __m128 f;
+            __m128 same = _mm_cmpeq_ps(d, _mm_set1_ps(drag.lastDamping()));
+            if (_mm_movemask_ps(same) == 0xf)
+            {
+                f = _mm_set1_ps(drag.lastFactor());
+            }
+            else
+            {
+                f = _mm_set_ps(drag.lookup(c.d[i+3]), drag.lookup(c.d[i+2]),
+                    drag.lookup(c.d[i+1]), drag.lookup(c.d[i]));
+            }
+
+            __m128 px = _mm_loadu_ps(c.px + i);
+            __m128 py = _mm_loadu_ps(c.py + i);
+            __m128 vx = _mm_loadu_ps(c.vx + i);
+            __m128 vy = _mm_loadu_ps(c.vy + i);
+            __m128 fx = _mm_loadu_ps(c.fx + i);
+            __m128 fy = _mm_loadu_ps(c.fy + i);
+
+            __m128 npx = _mm_add_ps(px, _mm_mul_ps(vx, dt));
+            __m128 npy = _mm_add_ps(py, _mm_mul_ps(vy, dt));
+
+            __m128 accx = _mm_add_ps(_mm_loadu_ps(c.ax + i), _mm_mul_ps(fx, w));
+            __m128 accy = _mm_add_ps(_mm_loadu_ps(c.ay + i), _mm_mul_ps(fy, w));
+            __m128 nvx = _mm_mul_ps(_mm_add_ps(vx, _mm_mul_ps(accx, dt)), f);
+            __m128 nvy = _mm_mul_ps(_mm_add_ps(vy, _mm_mul_ps(accy, dt)), f);
+
+            _mm_storeu_ps(c.px + i, _mm_or_ps(_mm_and_ps(movable, npx), _mm_andnot_ps(movable, px)));
+            _mm_storeu_ps(c.py + i, _mm_or_ps(_mm_and_ps(movable, npy), _mm_andnot_ps(movable, py)));
+            _mm_storeu_ps(c.vx + i, _mm_or_ps(_mm_and_ps(movable, nvx), _mm_andnot_ps(movable, vx)));
+            _mm_storeu_ps(c.vy + i, _mm_or_ps(_mm_and_ps(movable, nvy), _mm_andnot_ps(movable, vy)));
+            _mm_storeu_ps(c.fx + i, _mm_andnot_ps(movable, fx));
+            _mm_storeu_ps(c.fy + i, _mm_andnot_ps(movable, fy));
+        }
+
+        integrateScalar(c, i, count, duration, drag);
+    }
+
+    PINTEGRATE_TARGET_AVX2
+    void integrateAVX2(Channels &c, unsigned count, float duration,
+        DragTable &drag)
+    {
+        const __m256 dt = _mm256_set1_ps(duration);
+        const __m256 zero = _mm256_setzero_ps();
+
+        unsigned i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 w = _mm256_loadu_ps(c.w + i);
+
+            // Immovable particles keep their state untouched.
+            __m256 movable = _mm256_cmp_ps(w, zero, _CMP_GT_OQ);
+            if (_mm256_movemask_ps(movable) == 0) continue;
+
+            // Most runs of particles share a damping value, so only
+            // fall back to per-lane lookups when they differ.
+            __m256 d = _mm256_loadu_ps(c.d + i);
+            __m256 f;
+            __m256 same = _mm256_cmp_ps(d, _mm256_set1_ps(drag.lastDamping()), _CMP_EQ_OQ);
+            if (_mm256_movemask_ps(same) == 0xff)
+            {
+                f = _mm256_set1_ps(drag.lastFactor());
+            }
+            else
+            {
+                f = _mm256_set_ps(
+                    drag.lookup(c.d[i+7]), drag.lookup(c.d[i+6]),
+                    drag.lookup(c.d[i+5]), drag.lookup(c.d[i+4]),
+                    drag.lookup(c.d[i+3]), drag.lookup(c.d[i+2]),
+                    drag.lookup(c.d[i+1]), drag.lookup(c.d[i]));
+            }
+
+            __m256 px = _mm256_loadu_ps(c.px + i);
+            __m256 py = _mm256_loadu_ps(c.py + i);
+            __m256 vx = _mm256_loadu_ps(c.vx + i);
+            __m256 vy = _mm256_loadu_ps(c.vy + i);
+            __m256 fx = _mm256_loadu_ps(c.fx + i);
+            __m256 fy = _mm256_loadu_ps(c.fy + i);
+
+            __m256 npx = _mm256_add_ps(px, _mm256_mul_ps(vx, dt));
+            __m256 npy = _mm256_add_ps(py, _mm256_mul_ps(vy, dt));
+
+            __m256 accx = _mm256_add_ps(_mm256_loadu_ps(c.ax + i), _mm256_mul_ps(fx, w));
+            __m256 accy = _mm256_add_ps(_mm256_loadu_ps(c.ay + i), _mm256_mul_ps(fy, w));
+            __m256 nvx = _mm256_mul_ps(_mm256_add_ps(vx, _mm256_mul_ps(accx, dt)), f);
+            __m256 nvy = _mm256_mul_ps(_mm256_add_ps(vy, _mm256_mul_ps(accy, dt)), f);
+
+            _mm256_storeu_ps(c.px + i, _mm256_blendv_ps(px, npx, movable));
+            _mm256_storeu_ps(c.py + i, _mm256_blendv_ps(py, npy, movable));
+            _mm256_storeu_ps(c.vx + i, _mm256_blendv_ps(vx, nvx, movable));
+            _mm256_storeu_ps(c.vy + i, _mm256_blendv_ps(vy, nvy, movable));
+            _mm256_storeu_ps(c.fx + i, _mm256_andnot_ps(movable, fx));
+            _mm256_storeu_ps(c.fy + i, _mm256_andnot_ps(movable, fy));
+        }
+
+        integrateScalar(c, i, count, duration, drag);
+    }
+
+    /**
+     * The instruction sets the processor supports.
+     */
+    struct CpuFeatures
+    {
+        bool sse2;
+        bool avx2;
+    };
+
+    /**
+     * Queries the processor for SSE2 and AVX2 support. AVX2 also
+     * needs the operating system to save the wide registers.
+     */
+    CpuFeatures detectFeatures()
+    {
+        CpuFeatures features;
+        bool &sse2 = features.sse2;
+        bool &avx2 = features.avx2;
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        sse2 = (info[3] & (1 << 26)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+
+        avx2 = false;
+        if (maxLeaf >= 7 && osxsave && avx &&
+            (_xgetbv(0) & 0x6) == 0x6)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#else
+        __builtin_cpu_init();
+        sse2 = __builtin_cpu_supports("sse2") != 0;
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+        return features;
+    }
+
+#endif // PINTEGRATE_X86
+
+}
+
+
+ParticleIntegrator::ParticleIntegrator()
+:
+kernel(bestKernel())
+{
+}
+
+ParticleIntegrator::Kernel ParticleIntegrator::bestKernel()
+{
+    if (isSupported(KERNEL_AVX2)) return KERNEL_AVX2;
+    if (isSupported(KERNEL_SSE2)) return KERNEL_SSE2;
+    return KERNEL_SCALAR;
+}
+
+bool ParticleIntegrator::isSupported(Kernel kernel)
+{
+#ifdef PINTEGRATE_X86
+    // Initialised once, safely, by whichever thread asks first.
+    static const CpuFeatures features = detectFeatures();
+
+    switch (kernel)
+    {
+    case KERNEL_AVX2: return features.avx2;
+    case KERNEL_SSE2: return features.sse2;
+    default: return true;
+    }
+#else
+    return kernel == KERNEL_SCALAR;
+#endif
+}
+
+const char* ParticleIntegrator::getKernelName(Kernel kernel)
+{
+    switch (kernel)
+    {
+    case KERNEL_AVX2: return "avx2";
+    case KERNEL_SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+bool ParticleIntegrator::setKernel(Kernel kernel)
+{
+    if (!isSupported(kernel)) return false;
+    ParticleIntegrator::kernel = kernel;
+    return true;
+}
+
+ParticleIntegrator::Kernel ParticleIntegrator::getKernel() const
+{
+    return kernel;
+}
+
+void ParticleIntegrator::integrate(ParticleStore &store, float duration) const
+{
+    integrate(store, 0, store.size(), duration);
+}
+
+void ParticleIntegrator::integrate(ParticleStore &store, unsigned begin,
+    unsigned end, float duration) const
+{
+    assert(duration > 0.0);
+    assert(begin <= end && end <= store.size());
+    if (begin == end) return;
+
+    Channels channels(store, begin);
+    DragTable drag(duration);
+    unsigned count = end - begin;
+
+    switch (kernel)
+    {
+#ifdef PINTEGRATE_X86
+    case KERNEL_AVX2:
+        integrateAVX2(channels, count, duration, drag);
+        break;
+    case KERNEL_SSE2:
+        integrateSSE2(channels, count, duration, drag);
+        break;
+#endif
+    default:
+        integrateScalar(channels, 0, count, duration, drag);
+        break;
+    }
+}
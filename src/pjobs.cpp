@@ -0,0 +1,169 @@
+#include <cstdlib>
+#include <pjobs.h>
+
+
+namespace {
+
+    /**
+     * The pool and queue slot of the current thread, if it is a
+     * worker.
+     */
+    thread_local const ThreadPool *workerPool = NULL;
+    thread_local unsigned workerSlot = 0;
+
+}
+
+
+ThreadPool::ThreadPool(unsigned threads)
+:
+queued(0),
+stopping(false)
+{
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    for (unsigned i = 0; i < threads; i++) queues.push_back(new Queue);
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (unsigned i = 0; i < workers.size(); i++) workers[i].join();
+    for (unsigned i = 0; i < queues.size(); i++) delete queues[i];
+}
+
+unsigned ThreadPool::getThreadCount() const
+{
+    return (unsigned)queues.size();
+}
+
+unsigned ThreadPool::currentSlot() const
+{
+    return workerPool == this ? workerSlot : 0;
+}
+
+void ThreadPool::run(TaskGroup &group, const Task &task)
+{
+    group.pending.fetch_add(1);
+
+    Entry entry;
+    entry.task = task;
+    entry.group = &group;
+
+    // Count the task before it can be taken, so the count never
+    // drops below zero.
+    queued.fetch_add(1);
+    Queue &queue = *queues[currentSlot()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.entries.push_back(entry);
+    }
+
+    // Taking the lock orders this with a worker checking for work
+    // before it sleeps, so the wake-up cannot be missed.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::takeTask(unsigned slot, Entry &entry)
+{
+    // Newest work from our own queue first: it is likely still in
+    // cache.
+    {
+        Queue &queue = *queues[slot];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.entries.empty())
+        {
+            entry = queue.entries.back();
+            queue.entries.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Then the oldest work of the other threads, which tends to be
+    // the biggest.
+    unsigned count = (unsigned)queues.size();
+    for (unsigned i = 1; i < count; i++)
+    {
+        Queue &queue = *queues[(slot + i) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.entries.empty())
+        {
+            entry = queue.entries.front();
+            queue.entries.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runEntry(Entry &entry)
+{
+    entry.task();
+    entry.group->pending.fetch_sub(1);
+}
+
+void ThreadPool::wait(TaskGroup &group)
+{
+    unsigned slot = currentSlot();
+    Entry entry;
+    while (group.pending.load() > 0)
+    {
+        if (takeTask(slot, entry)) runEntry(entry);
+        else std::this_thread::yield();
+    }
+}
+
+void ThreadPool::workerLoop(unsigned slot)
+{
+    workerPool = this;
+    workerSlot = slot;
+
+    Entry entry;
+    for (;;)
+    {
+        if (takeTask(slot, entry))
+        {
+            runEntry(entry);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || queued.load() > 0; });
+        if (stopping) return;
+    }
+}
+
+void ThreadPool::parallelFor(unsigned count, unsigned grain, const RangeJob &job)
+{
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+
+    // Not worth queueing anything for a single chunk.
+    if (workers.empty() || count <= grain)
+    {
+        job(0, count);
+        return;
+    }
+
+    TaskGroup group;
+    for (unsigned begin = 0; begin < count; begin += grain)
+    {
+        unsigned end = count - begin > grain ? begin + grain : count;
+        run(group, [&job, begin, end]() { job(begin, end); });
+    }
+    wait(group);
+}
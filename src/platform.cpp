@@ -0,0 +1,417 @@
+#include <cstdlib>
+#include <math.h>
+#include <platform.h>
+
+
+Platform::Platform()
+:
+restitution(1.0f)
+{
+}
+
+Platform::Platform(ParticleWorld *world, float restitution)
+:
+ParticleBatchGenerator<Platform>(world),
+restitution(restitution)
+{
+}
+
+namespace {
+
+    /**
+     * The lanes the contact kernel works on: eight at a time where
+     * the compiler targets AVX, four otherwise.
+     */
+#ifdef CORE_SIMD_AVX
+    typedef Float8 ContactLanes;
+#else
+    typedef Float4 ContactLanes;
+#endif
+    typedef Vector2Lanes<ContactLanes> ContactVectors;
+
+}
+
+
+PlatformSegment::PlatformSegment()
+:
+inverseSquareLength(0),
+normal(0, 1)
+{
+}
+
+PlatformSegment::PlatformSegment(const Vector2 &start, const Vector2 &end)
+:
+start(start),
+direction(end - start),
+inverseSquareLength(0),
+normal(0, 1)
+{
+    float squareLength = direction.squareMagnitude();
+    if (squareLength > 0)
+    {
+        inverseSquareLength = 1.0f / squareLength;
+        normal = Vector2(-direction.y, direction.x) *
+            (1.0f / sqrt(squareLength));
+    }
+
+    min = Vector2(start.x < end.x ? start.x : end.x,
+                  start.y < end.y ? start.y : end.y);
+    max = Vector2(start.x > end.x ? start.x : end.x,
+                  start.y > end.y ? start.y : end.y);
+}
+
+bool Platform::checkContact(const Vector2 &start, const Vector2 &end,
+    const Vector2 &position, float radius,
+    Vector2 *normal, float *penetration)
+{
+    return checkContact(PlatformSegment(start, end), position, radius,
+                        normal, penetration);
+}
+
+bool Platform::checkContact(const PlatformSegment &segment,
+    const Vector2 &position, float radius,
+    Vector2 *normal, float *penetration)
+{
+    // Clamping the projection to the segment finds the closest point
+    // whether it lies between the ends or at one of them.
+    Vector2 toParticle = position - segment.start;
+    float projected = (toParticle * segment.direction) *
+        segment.inverseSquareLength;
+    projected = projected < 0 ? 0 : (projected > 1 ? 1 : projected);
+
+    Vector2 offset = toParticle - segment.direction * projected;
+    float squareDistance = offset.squareMagnitude();
+    if (squareDistance >= radius * radius) return false;
+
+    float distance = sqrt(squareDistance);
+    *normal = distance > 0 ? offset * (1.0f / distance) : segment.normal;
+    *penetration = radius - distance;
+    return true;
+}
+
+bool Platform::sweepContact(const Vector2 &start, const Vector2 &end,
+    const Vector2 &from, const Vector2 &to, float radius,
+    float *time, Vector2 *normal)
+{
+    Vector2 path = to - from;
+    float pathSqLength = path.squareMagnitude();
+    if (pathSqLength <= 0) return false;
+
+    // A circle touching at the start is already in contact.
+    Vector2 contactNormal;
+    float penetration;
+    if (checkContact(start, end, from, radius, &contactNormal, &penetration)) return false;
+
+    float squareRadius = radius * radius;
+    bool hit = false;
+
+    // The side of the platform: the circle hits it when its distance
+    // from the line falls to the radius, if the point it then touches
+    // lies between the ends.
+    Vector2 lineDirection = end - start;
+    float platformSqLength = lineDirection.squareMagnitude();
+    if (platformSqLength > 0)
+    {
+        Vector2 side(-lineDirection.y, lineDirection.x);
+        side *= 1.0f / sqrt(platformSqLength);
+
+        float distanceFrom = (from - start) * side;
+        if (distanceFrom < 0)
+        {
+            side.invert();
+            distanceFrom = -distanceFrom;
+        }
+        float distanceTo = (to - start) * side;
+
+        if (distanceFrom >= radius && distanceTo < radius)
+        {
+            float t = (distanceFrom - radius) / (distanceFrom - distanceTo);
+            Vector2 centre = from + path * t;
+            float projected = (centre - start) * lineDirection;
+            if (t <= *time && projected >= 0 && projected <= platformSqLength)
+            {
+                *time = t;
+                *normal = side;
+                hit = true;
+            }
+        }
+    }
+
+    // The ends: the circle hits one when its centre comes within the
+    // radius of it.
+    const Vector2 *ends[2] = { &start, &end };
+    for (unsigned e = 0; e < 2; e++)
+    {
+        Vector2 offset = from - *ends[e];
+        float c = offset.squareMagnitude() - squareRadius;
+        float b = offset * path;
+        float discriminant = b * b - pathSqLength * c;
+        if (b >= 0 || discriminant < 0) continue;
+
+        float t = (-b - sqrt(discriminant)) / pathSqLength;
+        if (t <= *time)
+        {
+            *time = t;
+            *normal = (from + path * t - *ends[e]) * (1.0f / radius);
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+bool Platform::sweep(const Vector2 &from, const Vector2 &to, float radius,
+                     float *time, Vector2 *normal) const
+{
+    PlatformSegment segment(start, end);
+    if ((from.x < to.x ? from.x : to.x) - radius > segment.max.x ||
+        (from.x > to.x ? from.x : to.x) + radius < segment.min.x ||
+        (from.y < to.y ? from.y : to.y) - radius > segment.max.y ||
+        (from.y > to.y ? from.y : to.y) + radius < segment.min.y) return false;
+
+    *time = 1.0f;
+    return sweepContact(start, end, from, to, radius, time, normal);
+}
+
+unsigned Platform::getFeatureCount() const
+{
+    return 1;
+}
+
+unsigned Platform::addContacts(const ParticleBatch &batch,
+                               ParticleContact *contact, unsigned limit) const
+{
+    unsigned used = 0;
+
+    // Stream through the world's particle arrays rather than the
+    // handles, a lane of particles at a time.
+    const ParticleStore &store = batch.store;
+    Particle *const *particles = batch.particles;
+    PlatformSegment segment(start, end);
+
+    const unsigned width = ContactLanes::WIDTH;
+    unsigned size = store.size();
+    unsigned i = 0;
+    for (; i + width <= size; i += width)
+    {
+        ContactVectors normal;
+        ContactLanes penetration;
+        int touching = checkContacts(segment,
+            ContactVectors::load(&store.positionX[i], &store.positionY[i]),
+            ContactLanes::load(&store.radius[i]),
+            &normal, &penetration).getMask();
+        if (!touching) continue;
+
+        float normalX[width], normalY[width], depth[width];
+        normal.store(normalX, normalY);
+        penetration.store(depth);
+
+        for (unsigned k = 0; k < width; k++)
+        {
+            if (!(touching & (1 << k)) || !store.awake[i + k]) continue;
+            if (used >= limit) return used;
+
+            contact->contactNormal = Vector2(normalX[k], normalY[k]);
+            contact->penetration = depth[k];
+            contact->restitution = restitution;
+            contact->particle[0] = particles[i + k];
+            contact->particle[1] = NULL;
+            contact->feature = batch.featureBase;
+            used++;
+            contact++;
+        }
+    }
+
+    // The particles left over from the last whole lane.
+    for (; i < size; i++)
+    {
+        if (!store.awake[i]) continue;
+
+        Vector2 position(store.positionX[i], store.positionY[i]);
+        if (checkContact(segment, position, store.radius[i],
+            &contact->contactNormal, &contact->penetration))
+        {
+            if (used >= limit) return used;
+
+            contact->restitution = restitution;
+            contact->particle[0] = particles[i];
+            contact->particle[1] = NULL;
+            contact->feature = batch.featureBase;
+            used++;
+            contact++;
+        }
+    }
+    return used;
+}
+
+
+namespace {
+
+    /**
+     * Receives the platforms near one particle from the hierarchy and
+     * writes a contact for each one it touches.
+     */
+    struct PlatformVisitor
+    {
+        const PlatformSegments &segments;
+        const ParticleBatch &batch;
+        Particle *particle;
+        Vector2 position;
+        float radius;
+        float restitution;
+        ParticleContact *contact;
+        unsigned used;
+        unsigned limit;
+
+        PlatformVisitor(const PlatformSegments &segments,
+                        const ParticleBatch &batch,
+                        float restitution, ParticleContact *contact,
+                        unsigned limit)
+            : segments(segments), batch(batch), particle(NULL), radius(0), restitution(restitution),
+              contact(contact), used(0), limit(limit) {}
+
+        void operator()(unsigned s)
+        {
+            if (used >= limit) return;
+
+            // A particle that has barely moved since last frame can
+            // keep its contact, corrected for the movement.
+            bool touching;
+            unsigned feature = batch.featureBase + s;
+            if (batch.cache.reuse(batch.owner, particle->getIndex(),
+                    ParticleContactCache::sceneryKey(feature), position, Vector2(),
+                    &contact->contactNormal, &contact->penetration))
+            {
+                touching = contact->penetration > 0;
+            }
+            else
+            {
+                touching = Platform::checkContact(segments[s], position,
+                    radius, &contact->contactNormal, &contact->penetration);
+            }
+
+            if (touching)
+            {
+                contact->restitution = restitution;
+                contact->particle[0] = particle;
+                contact->particle[1] = NULL;
+                contact->feature = feature;
+                used++;
+                contact++;
+            }
+        }
+    };
+
+}
+
+
+PlatformContacts::PlatformContacts(ParticleWorld *world, float restitution)
+:
+ParticleBatchGenerator<PlatformContacts>(world),
+restitution(restitution)
+{
+}
+
+void PlatformContacts::addPlatform(const Vector2 &start, const Vector2 &end)
+{
+    Segment segment;
+    segment.start = start;
+    segment.end = end;
+    segments.push_back(segment);
+    compiled.push_back(PlatformSegment(start, end));
+}
+
+void PlatformContacts::build()
+{
+    bvh.build(segments);
+}
+
+const Segments& PlatformContacts::getSegments() const
+{
+    return segments;
+}
+
+const PlatformSegments& PlatformContacts::getCompiledSegments() const
+{
+    return compiled;
+}
+
+const SegmentBVH& PlatformContacts::getBVH() const
+{
+    return bvh;
+}
+
+unsigned PlatformContacts::getFeatureCount() const
+{
+    return (unsigned)segments.size();
+}
+
+unsigned PlatformContacts::addContacts(const ParticleBatch &batch,
+                                       ParticleContact *contact,
+                                       unsigned limit) const
+{
+    const ParticleStore &store = batch.store;
+    Particle *const *particles = batch.particles;
+
+    PlatformVisitor visitor(compiled, batch, restitution, contact, limit);
+    for (unsigned i = 0; i < store.size(); i++)
+    {
+        if (visitor.used >= limit) break;
+
+        // Sleeping particles do not move, so need no contacts.
+        if (!store.awake[i]) continue;
+
+        visitor.particle = particles[i];
+        visitor.position = Vector2(store.positionX[i], store.positionY[i]);
+        visitor.radius = store.radius[i];
+
+        Vector2 reach(visitor.radius, visitor.radius);
+        bvh.query(visitor.position - reach, visitor.position + reach, visitor);
+    }
+    return visitor.used;
+}
+
+namespace {
+
+    /**
+     * Receives the platforms near a swept circle's path from the
+     * hierarchy and keeps the first one it hits.
+     */
+    struct SweepVisitor
+    {
+        const Segments &segments;
+        Vector2 from;
+        Vector2 to;
+        float radius;
+        float time;
+        Vector2 normal;
+        bool hit;
+
+        SweepVisitor(const Segments &segments, const Vector2 &from,
+                     const Vector2 &to, float radius)
+            : segments(segments), from(from), to(to), radius(radius),
+              time(1.0f), hit(false) {}
+
+        void operator()(unsigned s)
+        {
+            if (Platform::sweepContact(segments[s].start, segments[s].end,
+                    from, to, radius, &time, &normal)) hit = true;
+        }
+    };
+
+}
+
+bool PlatformContacts::sweep(const Vector2 &from, const Vector2 &to,
+                             float radius, float *time, Vector2 *normal) const
+{
+    SweepVisitor visitor(segments, from, to, radius);
+
+    Vector2 reach(radius, radius);
+    Vector2 min(from.x < to.x ? from.x : to.x, from.y < to.y ? from.y : to.y);
+    Vector2 max(from.x > to.x ? from.x : to.x, from.y > to.y ? from.y : to.y);
+    bvh.query(min - reach, max + reach, visitor);
+
+    if (!visitor.hit) return false;
+    *time = visitor.time;
+    *normal = visitor.normal;
+    return true;
+}
@@ -0,0 +1,176 @@
+#include <poccupancy.h>
+
+
+ParticleOccupancy::ParticleOccupancy()
+:
+enabled(false),
+inverseCellSize(1, 1),
+columns(1),
+rows(1),
+cellCounts(2, 0),
+cellRegionStart(2, 0)
+{
+}
+
+void ParticleOccupancy::setEnabled(bool enabled)
+{
+    // Particles moved while counting was off, so start again.
+    if (enabled && !ParticleOccupancy::enabled)
+    {
+        particleCells.clear();
+        cellCounts.assign(cellCounts.size(), 0);
+        regionCounts.assign(regionCounts.size(), 0);
+    }
+    ParticleOccupancy::enabled = enabled;
+}
+
+bool ParticleOccupancy::isEnabled() const
+{
+    return enabled;
+}
+
+void ParticleOccupancy::setGrid(const Vector2 &min, const Vector2 &max,
+                                unsigned columns, unsigned rows)
+{
+    if (columns < 1) columns = 1;
+    if (rows < 1) rows = 1;
+
+    origin = min;
+    inverseCellSize = Vector2(columns / (max.x - min.x), rows / (max.y - min.y));
+    ParticleOccupancy::columns = columns;
+    ParticleOccupancy::rows = rows;
+
+    unsigned cells = columns * rows;
+    particleCells.clear();
+    cellCounts.assign(cells + 1, 0);
+    regionCounts.clear();
+    cellRegionStart.assign(cells + 1, 0);
+    regionIndices.clear();
+}
+
+unsigned ParticleOccupancy::getColumns() const
+{
+    return columns;
+}
+
+unsigned ParticleOccupancy::getRows() const
+{
+    return rows;
+}
+
+unsigned ParticleOccupancy::addRegion(unsigned column, unsigned row,
+                                      unsigned columns, unsigned rows)
+{
+    unsigned region = (unsigned)regionCounts.size();
+    unsigned lastColumn = column + columns;
+    unsigned lastRow = row + rows;
+    if (lastColumn > ParticleOccupancy::columns) lastColumn = ParticleOccupancy::columns;
+    if (lastRow > ParticleOccupancy::rows) lastRow = ParticleOccupancy::rows;
+
+    // Rebuild the runs of regions by cell with the new one added to
+    // the cells it covers, counting what is already in them.
+    unsigned cells = ParticleOccupancy::columns * ParticleOccupancy::rows;
+    std::vector<unsigned> indices;
+    indices.reserve(regionIndices.size() + (lastColumn - column) * (lastRow - row));
+
+    unsigned total = 0;
+    for (unsigned cell = 0; cell < cells; cell++)
+    {
+        unsigned start = (unsigned)indices.size();
+        indices.insert(indices.end(),
+            regionIndices.begin() + cellRegionStart[cell],
+            regionIndices.begin() + cellRegionStart[cell + 1]);
+
+        unsigned c = cell % ParticleOccupancy::columns;
+        unsigned r = cell / ParticleOccupancy::columns;
+        if (c >= column && c < lastColumn && r >= row && r < lastRow)
+        {
+            indices.push_back(region);
+            total += cellCounts[cell];
+        }
+        cellRegionStart[cell] = start;
+    }
+    cellRegionStart[cells] = (unsigned)indices.size();
+    regionIndices.swap(indices);
+
+    regionCounts.push_back(total);
+    return region;
+}
+
+unsigned ParticleOccupancy::getRegionCount() const
+{
+    return (unsigned)regionCounts.size();
+}
+
+unsigned ParticleOccupancy::getCellCount(unsigned column, unsigned row) const
+{
+    return cellCounts[row * columns + column];
+}
+
+unsigned ParticleOccupancy::getRegionCount(unsigned region) const
+{
+    return regionCounts[region];
+}
+
+unsigned ParticleOccupancy::getOutsideCount() const
+{
+    return cellCounts[columns * rows];
+}
+
+unsigned ParticleOccupancy::findCell(float x, float y) const
+{
+    float column = (x - origin.x) * inverseCellSize.x;
+    float row = (y - origin.y) * inverseCellSize.y;
+
+    // Written so that a NaN position falls outside.
+    if (!(column >= 0 && column < columns && row >= 0 && row < rows))
+    {
+        return columns * rows;
+    }
+
+    unsigned c = (unsigned)column;
+    unsigned r = (unsigned)row;
+    if (c >= columns) c = columns - 1;
+    if (r >= rows) r = rows - 1;
+    return r * columns + c;
+}
+
+void ParticleOccupancy::count(unsigned cell, int amount)
+{
+    cellCounts[cell] += amount;
+
+    // The outside has no regions.
+    if (cell == columns * rows) return;
+    for (unsigned i = cellRegionStart[cell]; i < cellRegionStart[cell + 1]; i++)
+    {
+        regionCounts[regionIndices[i]] += amount;
+    }
+}
+
+void ParticleOccupancy::update(const ParticleStore &store)
+{
+    unsigned counted = (unsigned)particleCells.size();
+    unsigned size = store.size();
+    if (counted > size) counted = size;
+
+    for (unsigned i = 0; i < counted; i++)
+    {
+        if (!store.awake[i]) continue;
+
+        unsigned cell = findCell(store.positionX[i], store.positionY[i]);
+        if (cell == particleCells[i]) continue;
+
+        count(particleCells[i], -1);
+        count(cell, 1);
+        particleCells[i] = cell;
+    }
+
+    // Particles created since the last update are counted wherever
+    // they are, awake or not.
+    for (unsigned i = counted; i < size; i++)
+    {
+        unsigned cell = findCell(store.positionX[i], store.positionY[i]);
+        particleCells.push_back(cell);
+        count(cell, 1);
+    }
+}
@@ -0,0 +1,206 @@
+#include <limits.h>
+#include <algorithm>
+#include <psleep.h>
+
+
+namespace {
+
+    /**
+     * Returns true if the particle is awake and can move, so it can
+     * wake others and join an island.
+     */
+    inline bool isActive(const ParticleStore &store, unsigned index)
+    {
+        return store.awake[index] && store.inverseMass[index] > 0;
+    }
+
+    const unsigned NO_PARTICLE = UINT_MAX;
+
+}
+
+
+ParticleSleep::ParticleSleep(float velocityThreshold, unsigned framesToSleep)
+:
+enabled(false),
+velocityThreshold(velocityThreshold),
+framesToSleep(framesToSleep),
+sleepingCount(0)
+{
+}
+
+void ParticleSleep::setEnabled(bool enabled)
+{
+    ParticleSleep::enabled = enabled;
+}
+
+bool ParticleSleep::isEnabled() const
+{
+    return enabled;
+}
+
+void ParticleSleep::setVelocityThreshold(float velocityThreshold)
+{
+    ParticleSleep::velocityThreshold = velocityThreshold;
+}
+
+float ParticleSleep::getVelocityThreshold() const
+{
+    return velocityThreshold;
+}
+
+void ParticleSleep::setFramesToSleep(unsigned framesToSleep)
+{
+    ParticleSleep::framesToSleep = framesToSleep;
+}
+
+unsigned ParticleSleep::getFramesToSleep() const
+{
+    return framesToSleep;
+}
+
+unsigned ParticleSleep::getSleepingCount() const
+{
+    return sleepingCount;
+}
+
+void ParticleSleep::wake(ParticleStore &store, unsigned index)
+{
+    if (store.awake[index]) return;
+
+    // Walk the ring, leaving each particle a ring of its own.
+    unsigned i = index;
+    do
+    {
+        unsigned following = next[i];
+        store.awake[i] = 1;
+        restFrames[i] = 0;
+        next[i] = i;
+        sleepingCount--;
+        i = following;
+    }
+    while (i != index);
+}
+
+void ParticleSleep::wakeAll(ParticleStore &store)
+{
+    for (unsigned i = 0; sleepingCount > 0 && i < store.size(); i++)
+    {
+        wake(store, i);
+    }
+}
+
+void ParticleSleep::wakeTouched(ParticleStore &store, ParticlePairs &pairs)
+{
+    // Waking an island can leave another pair half asleep, so repeat
+    // until none are.
+    bool woke = sleepingCount > 0;
+    while (woke)
+    {
+        woke = false;
+        for (unsigned p = 0; p < pairs.size(); p++)
+        {
+            unsigned i = pairs[p].first;
+            unsigned j = pairs[p].second;
+
+            if (!store.awake[i] && isActive(store, j)) wake(store, i);
+            else if (!store.awake[j] && isActive(store, i)) wake(store, j);
+            else continue;
+            woke = true;
+        }
+    }
+
+    // Pairs with nothing awake that can move need no contact.
+    pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+        [&store](const ParticlePair &pair) {
+            return !isActive(store, pair.first) && !isActive(store, pair.second);
+        }), pairs.end());
+}
+
+unsigned ParticleSleep::findRoot(unsigned index)
+{
+    unsigned root = index;
+    while (parent[root] != root) root = parent[root];
+
+    while (parent[index] != root)
+    {
+        unsigned up = parent[index];
+        parent[index] = root;
+        index = up;
+    }
+    return root;
+}
+
+void ParticleSleep::update(ParticleStore &store, const ParticleContact *contacts,
+                           unsigned count)
+{
+    unsigned size = store.size();
+    restFrames.resize(size, 0);
+    while (next.size() < size) next.push_back((unsigned)next.size());
+
+    // Count how long each particle has been resting.
+    float squareThreshold = velocityThreshold * velocityThreshold;
+    for (unsigned i = 0; i < size; i++)
+    {
+        if (!isActive(store, i)) continue;
+
+        float squareSpeed = store.velocityX[i] * store.velocityX[i] +
+            store.velocityY[i] * store.velocityY[i];
+        if (squareSpeed >= squareThreshold) restFrames[i] = 0;
+        else if (restFrames[i] < framesToSleep) restFrames[i]++;
+    }
+
+    // Join the particles in contact into islands.
+    parent.resize(size);
+    for (unsigned i = 0; i < size; i++) parent[i] = i;
+
+    for (unsigned c = 0; c < count; c++)
+    {
+        const ParticleContact &contact = contacts[c];
+        if (!contact.particle[1]) continue;
+
+        unsigned i = contact.particle[0]->getIndex();
+        unsigned j = contact.particle[1]->getIndex();
+        if (!isActive(store, i) || !isActive(store, j)) continue;
+
+        unsigned rootI = findRoot(i);
+        unsigned rootJ = findRoot(j);
+        if (rootI != rootJ) parent[rootJ] = rootI;
+    }
+
+    // An island is resting as long as its least rested particle.
+    islandRest.assign(size, UINT_MAX);
+    islandRing.assign(size, NO_PARTICLE);
+    for (unsigned i = 0; i < size; i++)
+    {
+        if (!isActive(store, i)) continue;
+
+        unsigned root = findRoot(i);
+        islandRest[root] = std::min(islandRest[root], restFrames[i]);
+    }
+
+    // Put the rested islands to sleep, linking each into a ring.
+    for (unsigned i = 0; i < size; i++)
+    {
+        if (!isActive(store, i)) continue;
+
+        unsigned root = parent[i];
+        if (islandRest[root] < framesToSleep) continue;
+
+        store.awake[i] = 0;
+        store.velocityX[i] = 0;
+        store.velocityY[i] = 0;
+        sleepingCount++;
+
+        unsigned &head = islandRing[root];
+        if (head == NO_PARTICLE)
+        {
+            head = i;
+            next[i] = i;
+        }
+        else
+        {
+            next[i] = next[head];
+            next[head] = i;
+        }
+    }
+}
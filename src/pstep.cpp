@@ -0,0 +1,115 @@
+#include <pstep.h>
+
+
+ParticleStepper::ParticleStepper(ParticleWorld *world, float stepSize,
+                                 unsigned maxSteps)
+:
+world(world),
+stepSize(stepSize),
+maxSteps(maxSteps),
+accumulator(0),
+simulatedTime(0),
+droppedTime(0),
+started(false)
+{
+}
+
+void ParticleStepper::setStepSize(float stepSize)
+{
+    ParticleStepper::stepSize = stepSize;
+}
+
+float ParticleStepper::getStepSize() const
+{
+    return stepSize;
+}
+
+void ParticleStepper::setMaxSteps(unsigned maxSteps)
+{
+    ParticleStepper::maxSteps = maxSteps;
+}
+
+unsigned ParticleStepper::getMaxSteps() const
+{
+    return maxSteps;
+}
+
+unsigned ParticleStepper::advance()
+{
+    Clock::time_point now = Clock::now();
+    double elapsed = started ?
+        std::chrono::duration<double>(now - lastTime).count() : 0;
+    lastTime = now;
+    started = true;
+
+    return advance(elapsed);
+}
+
+unsigned ParticleStepper::advance(double elapsed)
+{
+    accumulator += elapsed;
+
+    unsigned steps = (unsigned)(accumulator / stepSize);
+    if (steps > maxSteps)
+    {
+        // Too far behind: keep the fraction of a step and drop the
+        // rest.
+        double kept = accumulator - steps * (double)stepSize;
+        droppedTime += accumulator - kept - maxSteps * (double)stepSize;
+        accumulator = kept + maxSteps * (double)stepSize;
+        steps = maxSteps;
+    }
+
+    for (unsigned s = 0; s < steps; s++)
+    {
+        // Only the last step's starting positions are interpolated
+        // from.
+        if (s + 1 == steps)
+        {
+            const ParticleStore &store = world->getStore();
+            previousX = store.positionX;
+            previousY = store.positionY;
+        }
+
+        world->runPhysics(stepSize);
+        accumulator -= stepSize;
+        simulatedTime += stepSize;
+    }
+
+    return steps;
+}
+
+void ParticleStepper::reset()
+{
+    accumulator = 0;
+    started = false;
+}
+
+float ParticleStepper::getAlpha() const
+{
+    float alpha = (float)(accumulator / stepSize);
+    return alpha < 1.0f ? alpha : 1.0f;
+}
+
+Vector2 ParticleStepper::getInterpolatedPosition(const Particle *particle) const
+{
+    Vector2 position = particle->getPosition();
+
+    // Particles created since the last step have nothing to
+    // interpolate from.
+    unsigned index = particle->getIndex();
+    if (index >= previousX.size()) return position;
+
+    Vector2 previous(previousX[index], previousY[index]);
+    return previous + (position - previous) * getAlpha();
+}
+
+double ParticleStepper::getSimulatedTime() const
+{
+    return simulatedTime;
+}
+
+double ParticleStepper::getDroppedTime() const
+{
+    return droppedTime;
+}
@@ -0,0 +1,69 @@
+#include <math.h>
+#include <assert.h>
+#include <pstore.h>
+
+
+unsigned ParticleStore::add()
+{
+    unsigned index = size();
+
+    positionX.push_back(0);
+    positionY.push_back(0);
+    velocityX.push_back(0);
+    velocityY.push_back(0);
+    accelerationX.push_back(0);
+    accelerationY.push_back(0);
+    forceX.push_back(0);
+    forceY.push_back(0);
+    inverseMass.push_back(0);
+    damping.push_back(1);
+    radius.push_back(0);
+    awake.push_back(1);
+
+    return index;
+}
+
+unsigned ParticleStore::size() const
+{
+    return (unsigned)positionX.size();
+}
+
+void ParticleStore::reserve(unsigned count)
+{
+    positionX.reserve(count);
+    positionY.reserve(count);
+    velocityX.reserve(count);
+    velocityY.reserve(count);
+    accelerationX.reserve(count);
+    accelerationY.reserve(count);
+    forceX.reserve(count);
+    forceY.reserve(count);
+    inverseMass.reserve(count);
+    damping.reserve(count);
+    radius.reserve(count);
+    awake.reserve(count);
+}
+
+void ParticleStore::integrate(unsigned index, float duration)
+{
+    // We don't integrate things with zero mass.
+    float w = inverseMass[index];
+    if (w <= 0.0f) return;
+
+    assert(duration > 0.0);
+    positionX[index] += velocityX[index] * duration;
+    positionY[index] += velocityY[index] * duration;
+
+    // Work out the acceleration from the force
+    float ax = accelerationX[index] + forceX[index] * w;
+    float ay = accelerationY[index] + forceY[index] * w;
+
+    // Update linear velocity from the acceleration, and impose drag.
+    float drag = pow(damping[index], duration);
+    velocityX[index] = (velocityX[index] + ax * duration) * drag;
+    velocityY[index] = (velocityY[index] + ay * duration) * drag;
+
+    // Clear the forces.
+    forceX[index] = 0;
+    forceY[index] = 0;
+}
@@ -1,70 +1,460 @@
 
 #include <cstdlib>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
 #include <pworld.h>
 
+#ifdef PWORLD_NO_STATS
+#define PWORLD_STAT(statement)
+#else
+#define PWORLD_STAT(statement) statement
+#endif
+
+
+namespace {
+
+    /**
+     * Measures the time between successive laps.
+     */
+    class PhaseTimer
+    {
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        PhaseTimer() : start(std::chrono::steady_clock::now()) {}
+
+        /**
+         * Returns the seconds since the last lap, or since the timer
+         * was created, and starts a new lap.
+         */
+        double lap()
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - start).count();
+            start = now;
+            return seconds;
+        }
+    };
+
+#ifndef PWORLD_NO_STATS
+    /**
+     * Adds the figures of a substep to the totals of the step so far.
+     */
+    void accumulate(ParticleStepStats &total, const ParticleStepStats &step)
+    {
+        total.integrateTime += step.integrateTime;
+        total.broadphaseTime += step.broadphaseTime;
+        total.generateTime += step.generateTime;
+        for (unsigned g = 0; g < total.generatorTime.size() &&
+             g < step.generatorTime.size(); g++)
+        {
+            total.generatorTime[g] += step.generatorTime[g];
+        }
+        total.resolveTime += step.resolveTime;
+        total.correctTime += step.correctTime;
+        total.sleepTime += step.sleepTime;
+        total.occupancyTime += step.occupancyTime;
+        total.contactsGenerated += step.contactsGenerated;
+        total.contactsDropped += step.contactsDropped;
+        total.overflowed = total.overflowed || step.overflowed;
+        total.iterationsUsed += step.iterationsUsed;
+        total.contactsReused += step.contactsReused;
+        total.particlesAsleep = step.particlesAsleep;
+        total.particlesSwept += step.particlesSwept;
+        total.particlesStopped += step.particlesStopped;
+    }
+#endif
+
+    /**
+     * Integrates particles [begin, end) of the store. If some may be
+     * asleep, only the runs of awake particles are integrated, so
+     * the kernels still stream through contiguous arrays.
+     */
+    void integrateAwake(const ParticleIntegrator &integrator,
+                        ParticleStore &store, unsigned begin, unsigned end,
+                        bool skipSleeping, float duration)
+    {
+        if (!skipSleeping)
+        {
+            integrator.integrate(store, begin, end, duration);
+            return;
+        }
+
+        unsigned i = begin;
+        while (i < end)
+        {
+            while (i < end && !store.awake[i]) i++;
+            unsigned run = i;
+            while (i < end && store.awake[i]) i++;
+            if (i > run) integrator.integrate(store, run, i, duration);
+        }
+    }
+
+}
+
 ParticleWorld::ParticleWorld(unsigned maxContacts, unsigned iterations)
 :
 resolver(iterations),
-maxContacts(maxContacts)
+sweepThreshold(0),
+maxSubsteps(1),
+courantNumber(0.5f),
+coloredResolver(NULL),
+broadphase(NULL),
+contacts(maxContacts),
+queryGridCurrent(false),
+threadPool(NULL)
 {
-    contacts = new ParticleContact[maxContacts];
     calculateIterations = (iterations == 0);
-
+    stats = ParticleStepStats();
 }
 
 ParticleWorld::~ParticleWorld()
 {
-    delete[] contacts;
+    for (Particles::iterator p = particles.begin();
+        p != particles.end();
+        p++)
+    {
+        delete *p;
+    }
+    delete threadPool;
 }
 
 unsigned ParticleWorld::generateContacts()
 {
-    unsigned limit = maxContacts;
-    ParticleContact *nextContact = contacts;
+    PWORLD_STAT(PhaseTimer timer);
+    PWORLD_STAT(stats.generatorTime.assign(contactGenerators.size(), 0));
+    PWORLD_STAT(unsigned overflows = contacts.getOverflowCount());
 
-    for (ContactGenerators::iterator g = contactGenerators.begin();
-        g != contactGenerators.end();
-        g++)
+    unsigned used = 0;
+    if (threadPool && contactGenerators.size() > 1)
     {
-        unsigned used =(*g)->addContact(nextContact, limit);
-        limit -= used;
-        nextContact += used;
+        // Run each generator into its own arena, then copy them over
+        // in registration order, cutting off at the same point the
+        // serial loop below would.
+        unsigned count = (unsigned)contactGenerators.size();
+        generatorContacts.resize(count);
+        generatorUsed.resize(count);
+        generatorOverflows.resize(count);
+
+        TaskGroup group;
+        for (unsigned g = 0; g < count; g++)
+        {
+            generatorContacts[g].setLimit(contacts.getLimit());
+            generatorOverflows[g] = generatorContacts[g].getOverflowCount();
+            threadPool->run(group, [this, g]() {
+                PWORLD_STAT(PhaseTimer generatorTimer);
+                generatorUsed[g] = generatorContacts[g].generate(contactGenerators[g], 0);
+                PWORLD_STAT(stats.generatorTime[g] = generatorTimer.lap());
+            });
+        }
+        threadPool->wait(group);
+
+        for (unsigned g = 0; g < count; g++)
+        {
+            unsigned appendOverflows = contacts.getOverflowCount();
+            unsigned kept = contacts.append(generatorContacts[g].getContacts(),
+                                            generatorUsed[g], used);
+            used += kept;
+            generatorUsed[g] = kept;
 
-        // We've run out of contacts to fill. This means we're missing
-        // contacts.
-        if (limit <= 0) break;
+            // A generator cut short in its own arena lost contacts to
+            // the same cap, even if what it kept fitted here.
+            if (contacts.getOverflowCount() == appendOverflows &&
+                generatorContacts[g].getOverflowCount() != generatorOverflows[g])
+            {
+                contacts.recordOverflow();
+            }
+        }
     }
+    else
+    {
+        generatorUsed.resize(contactGenerators.size());
+        for (unsigned g = 0; g < contactGenerators.size(); g++)
+        {
+            PWORLD_STAT(PhaseTimer generatorTimer);
+            generatorUsed[g] = contacts.generate(contactGenerators[g], used);
+            used += generatorUsed[g];
+            PWORLD_STAT(stats.generatorTime[g] = generatorTimer.lap());
+        }
+    }
+
+    // Remember this frame's contacts, by the generator that made them.
+    PWORLD_STAT(stats.contactsReused = 0);
+    if (cache.isEnabled())
+    {
+        cache.startFrame(used);
+        unsigned begin = 0;
+        for (unsigned g = 0; g < contactGenerators.size(); g++)
+        {
+            cache.store(contactGenerators[g], contacts.getContacts(),
+                        begin, begin + generatorUsed[g]);
+            begin += generatorUsed[g];
+        }
+        PWORLD_STAT(stats.contactsReused = cache.getReusedCount());
+    }
+
+    PWORLD_STAT(stats.generateTime = timer.lap());
+    PWORLD_STAT(stats.contactsGenerated = used);
+    // Each generator cut short is only seen to have had one contact
+    // more than it kept, whichever path ran it.
+    PWORLD_STAT(stats.contactsDropped = contacts.getOverflowCount() - overflows);
+    PWORLD_STAT(stats.overflowed = stats.contactsDropped != 0);
 
     // Return the number of contacts used.
-    return maxContacts - limit;
+    return used;
 }
 
 void ParticleWorld::integrate(float duration)
 {
-    for (Particles::iterator p = particles.begin();
-        p != particles.end();
-        p++)
+    PWORLD_STAT(PhaseTimer timer);
+
+    bool sweeping = sweepThreshold > 0 && !obstacles.empty();
+    if (sweeping) findFastParticles(duration);
+    queryGridCurrent = false;
+
+    if (!threadPool)
+    {
+        integrateAwake(integrator, store, 0, store.size(),
+                       sleep.getSleepingCount() > 0, duration);
+    }
+    else
+    {
+        // Particles are independent, so the store is split into
+        // chunks a multiple of the widest kernel's lane count.
+        bool skipSleeping = sleep.getSleepingCount() > 0;
+        threadPool->parallelFor(store.size(), 4096,
+            [this, skipSleeping, duration](unsigned begin, unsigned end) {
+            integrateAwake(integrator, store, begin, end, skipSleeping, duration);
+        });
+    }
+
+    PWORLD_STAT(stats.particlesSwept = 0);
+    PWORLD_STAT(stats.particlesStopped = 0);
+    if (sweeping) sweepFastParticles();
+
+    PWORLD_STAT(stats.integrateTime = timer.lap());
+}
+
+void ParticleWorld::findFastParticles(float duration)
+{
+    sweptParticles.clear();
+    sweptFrom.clear();
+
+    // Integration moves a particle by its velocity before updating
+    // it, so this is exactly how far each will go.
+    float squareDuration = duration * duration;
+    float squareThreshold = sweepThreshold * sweepThreshold;
+    for (unsigned i = 0; i < store.size(); i++)
+    {
+        if (!store.awake[i] || store.inverseMass[i] <= 0) continue;
+
+        float squareSpeed = store.velocityX[i] * store.velocityX[i] +
+            store.velocityY[i] * store.velocityY[i];
+        float squareReach = squareThreshold * store.radius[i] * store.radius[i];
+        if (squareSpeed * squareDuration <= squareReach) continue;
+
+        sweptParticles.push_back(i);
+        sweptFrom.push_back(Vector2(store.positionX[i], store.positionY[i]));
+    }
+}
+
+void ParticleWorld::sweepFastParticles()
+{
+    for (unsigned s = 0; s < sweptParticles.size(); s++)
     {
-        // Remove all forces from the accumulator
-        (*p)->integrate(duration);
+        unsigned i = sweptParticles[s];
+        const Vector2 &from = sweptFrom[s];
+        Vector2 to(store.positionX[i], store.positionY[i]);
+        float radius = store.radius[i];
+
+        // Find the first obstacle hit on the way.
+        float firstTime = 2.0f;
+        Vector2 firstNormal;
+        for (unsigned o = 0; o < obstacles.size(); o++)
+        {
+            float time;
+            Vector2 normal;
+            if (obstacles[o]->sweep(from, to, radius, &time, &normal) &&
+                time < firstTime)
+            {
+                firstTime = time;
+                firstNormal = normal;
+            }
+        }
+        if (firstTime > 1.0f) continue;
+
+        // Stop where it first touches, sunk in by a sliver of its
+        // radius so that the generators report the contact. The
+        // rest of the step's motion is lost.
+        Vector2 position = from + (to - from) * firstTime;
+        position.addScaledVector(firstNormal, -0.01f * radius);
+        store.positionX[i] = position.x;
+        store.positionY[i] = position.y;
+        PWORLD_STAT(stats.particlesStopped++);
     }
+    PWORLD_STAT(stats.particlesSwept = (unsigned)sweptParticles.size());
+}
+
+void ParticleWorld::findPairs()
+{
+    PWORLD_STAT(PhaseTimer timer);
+
+    if (broadphase) broadphase->findPairs(store, pairs);
+    else pairs.clear();
+
+    if (sleep.isEnabled()) sleep.wakeTouched(store, pairs);
+
+    PWORLD_STAT(stats.broadphaseTime = timer.lap());
 }
 
-void ParticleWorld::runPhysics(float duration)
+void ParticleWorld::resolveContacts(unsigned usedContacts, float duration)
 {
+    PWORLD_STAT(PhaseTimer timer);
+    PWORLD_STAT(stats.iterationsUsed = 0);
+
+    if (usedContacts)
+    {
+        if (cache.isEnabled()) cache.warmStart(contacts.getContacts(), usedContacts);
+
+        if (coloredResolver)
+        {
+            coloredResolver->resolveContacts(contacts.getContacts(), usedContacts, duration);
+            PWORLD_STAT(stats.iterationsUsed = coloredResolver->getIterationsUsed());
+        }
+        else
+        {
+            if (calculateIterations) resolver.setIterations(usedContacts * 2);
+            resolver.resolveContacts(contacts.getContacts(), usedContacts, duration);
+            PWORLD_STAT(stats.iterationsUsed = resolver.getIterationsUsed());
+        }
+
+        if (cache.isEnabled()) cache.storeImpulses(contacts.getContacts(), usedContacts);
+    }
+
+    PWORLD_STAT(stats.resolveTime = timer.lap());
+
+    // With the velocities settled, push apart what still overlaps.
+    if (usedContacts && corrector.isEnabled())
+    {
+        corrector.correctPositions(store, contacts.getContacts(), usedContacts);
+        queryGridCurrent = false;
+    }
 
+    PWORLD_STAT(stats.correctTime = timer.lap());
+}
+
+unsigned ParticleWorld::calculateSubsteps(float duration) const
+{
+    if (maxSubsteps <= 1) return 1;
+
+    // Find the fastest and the smallest of the particles that move.
+    float maxSquareSpeed = 0;
+    float minRadius = 0;
+    for (unsigned i = 0; i < store.size(); i++)
+    {
+        if (!store.awake[i] || store.inverseMass[i] <= 0) continue;
+
+        float squareSpeed = store.velocityX[i] * store.velocityX[i] +
+            store.velocityY[i] * store.velocityY[i];
+        if (squareSpeed > maxSquareSpeed) maxSquareSpeed = squareSpeed;
+
+        float radius = store.radius[i];
+        if (radius > 0 && (minRadius == 0 || radius < minRadius)) minRadius = radius;
+    }
+    if (minRadius == 0 || courantNumber <= 0) return 1;
+
+    // Take enough substeps that none moves further than its share.
+    float travel = sqrtf(maxSquareSpeed) * duration;
+    float substeps = ceilf(travel / (courantNumber * minRadius));
+    if (substeps <= 1) return 1;
+    if (substeps >= (float)maxSubsteps) return maxSubsteps;
+    return (unsigned)substeps;
+}
+
+unsigned ParticleWorld::runPhysics(float duration)
+{
+    PWORLD_STAT(PhaseTimer timer);
+
+    unsigned substeps = calculateSubsteps(duration);
+    if (substeps == 1)
+    {
+        step(duration);
+    }
+    else
+    {
+        float substep = duration / substeps;
+        PWORLD_STAT(ParticleStepStats total);
+        for (unsigned s = 0; s < substeps; s++)
+        {
+            step(substep);
+            PWORLD_STAT(if (s == 0) total = stats; else accumulate(total, stats));
+        }
+        PWORLD_STAT(stats = total);
+    }
+
+    PWORLD_STAT(stats.substeps = substeps);
+    PWORLD_STAT(stats.stepTime = timer.lap());
+    return substeps;
+}
+
+void ParticleWorld::step(float duration)
+{
     // Then integrate the objects
     integrate(duration);
 
+    // Find the particles that overlap
+    findPairs();
+
     // Generate contacts
     unsigned usedContacts = generateContacts();
 
     // And process them
-    if (usedContacts)
-    {
-        if (calculateIterations) resolver.setIterations(usedContacts * 2);
-        resolver.resolveContacts(contacts, usedContacts, duration);
-    }
+    resolveContacts(usedContacts, duration);
+
+    // Put to sleep the islands that have come to rest
+    PWORLD_STAT(PhaseTimer sleepTimer);
+    if (sleep.isEnabled()) sleep.update(store, contacts.getContacts(), usedContacts);
+    PWORLD_STAT(stats.sleepTime = sleepTimer.lap());
+    PWORLD_STAT(stats.particlesAsleep = sleep.getSleepingCount());
+
+    // Move the particles that crossed a cell boundary in the counts
+    if (occupancy.isEnabled()) occupancy.update(store);
+    PWORLD_STAT(stats.occupancyTime = sleepTimer.lap());
+}
+
+void ParticleWorld::setMaxSubsteps(unsigned maxSubsteps)
+{
+    ParticleWorld::maxSubsteps = maxSubsteps;
+}
+
+unsigned ParticleWorld::getMaxSubsteps() const
+{
+    return maxSubsteps;
+}
+
+void ParticleWorld::setCourantNumber(float courantNumber)
+{
+    ParticleWorld::courantNumber = courantNumber;
+}
+
+float ParticleWorld::getCourantNumber() const
+{
+    return courantNumber;
+}
+
+Particle* ParticleWorld::createParticle()
+{
+    Particle *particle = new Particle(&store, store.add());
+    particles.push_back(particle);
+    queryGridCurrent = false;
+    return particle;
+}
+
+void ParticleWorld::reserveParticles(unsigned count)
+{
+    store.reserve(count);
+    particles.reserve(count);
 }
 
 ParticleWorld::Particles& ParticleWorld::getParticles()
@@ -72,7 +462,153 @@ ParticleWorld::Particles& ParticleWorld::getParticles()
     return particles;
 }
 
+ParticleStore& ParticleWorld::getStore()
+{
+    return store;
+}
+
+ParticleContactResolver& ParticleWorld::getResolver()
+{
+    return resolver;
+}
+
+void ParticleWorld::setColoredResolver(ParticleColoredResolver *coloredResolver)
+{
+    ParticleWorld::coloredResolver = coloredResolver;
+}
+
+ParticleIntegrator& ParticleWorld::getIntegrator()
+{
+    return integrator;
+}
+
 ParticleWorld::ContactGenerators& ParticleWorld::getContactGenerators()
 {
     return contactGenerators;
 }
+
+ParticleWorld::Obstacles& ParticleWorld::getObstacles()
+{
+    return obstacles;
+}
+
+void ParticleWorld::setSweepThreshold(float sweepThreshold)
+{
+    ParticleWorld::sweepThreshold = sweepThreshold;
+}
+
+float ParticleWorld::getSweepThreshold() const
+{
+    return sweepThreshold;
+}
+
+void ParticleWorld::setBroadphase(ParticleBroadphase *broadphase)
+{
+    ParticleWorld::broadphase = broadphase;
+    if (broadphase) broadphase->setThreadPool(threadPool);
+}
+
+ParticleContactArena& ParticleWorld::getContactArena()
+{
+    return contacts;
+}
+
+ParticleContactCache& ParticleWorld::getContactCache()
+{
+    return cache;
+}
+
+ParticlePositionCorrector& ParticleWorld::getPositionCorrector()
+{
+    return corrector;
+}
+
+ParticleSleep& ParticleWorld::getSleep()
+{
+    return sleep;
+}
+
+ParticleOccupancy& ParticleWorld::getOccupancy()
+{
+    return occupancy;
+}
+
+const ParticlePairs& ParticleWorld::getPairs() const
+{
+    return pairs;
+}
+
+void ParticleWorld::updateQueryGrid(float cellSize, float minCellSize,
+                                    float maxCellSize)
+{
+    float current = queryGrid.getCellSize();
+    if (queryGridCurrent && current >= minCellSize && current <= maxCellSize) return;
+
+    queryGrid.build(store, cellSize);
+    queryGridCurrent = true;
+}
+
+void ParticleWorld::findPairsWithin(float distance, ParticlePairs &pairs)
+{
+    pairs.clear();
+    if (distance <= 0) return;
+
+    // The cells must be at least the distance across for the pairs to
+    // lie in neighbouring cells, and not so much more that each cell
+    // holds many particles too far apart.
+    updateQueryGrid(distance, distance, 2.0f * distance);
+    queryGrid.findPairsWithin(store, distance, pairs);
+}
+
+void ParticleWorld::findNeighbours(const Vector2 &point, float distance,
+                                   std::vector<unsigned> &neighbours)
+{
+    neighbours.clear();
+    if (distance <= 0) return;
+
+    // Any cell size works, but much smaller cells mean many to search.
+    updateQueryGrid(distance, 0.25f * distance, 4.0f * distance);
+    queryGrid.findNeighbours(store, point, distance, neighbours);
+}
+
+void ParticleWorld::setThreadCount(unsigned threads)
+{
+    ThreadPool *oldPool = threadPool;
+    threadPool = NULL;
+
+    if (threads != 1)
+    {
+        threadPool = new ThreadPool(threads);
+        if (threadPool->getThreadCount() == 1)
+        {
+            delete threadPool;
+            threadPool = NULL;
+        }
+    }
+
+    if (broadphase) broadphase->setThreadPool(threadPool);
+    queryGrid.setThreadPool(threadPool);
+
+    // Move a coloured resolver sharing the old pool onto the new one
+    // before the old one goes.
+    if (coloredResolver && coloredResolver->getThreadPool() == oldPool)
+    {
+        coloredResolver->setThreadPool(threadPool);
+    }
+    delete oldPool;
+}
+
+unsigned ParticleWorld::getThreadCount() const
+{
+    return threadPool ? threadPool->getThreadCount() : 1;
+}
+
+ThreadPool* ParticleWorld::getThreadPool()
+{
+    return threadPool;
+}
+
+const ParticleStepStats& ParticleWorld::getStepStats() const
+{
+    return stats;
+}